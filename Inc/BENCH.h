@@ -0,0 +1,21 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdint.h>
+#include "stm32f4xx.h"
+
+/* Set to 1 to print the benchmarks over USART2 at boot */
+#ifndef BENCH_ON_BOOT
+#define BENCH_ON_BOOT       0
+#endif
+
+#define BENCH_ITERATIONS    16U
+#define BENCH_FAILED        0xFFFFFFFFU
+
+void Bench_Init(void);
+/* Per-switch (arm and check) and per-fault (store to handler) cycles of every guard backend */
+void Bench_GuardBackends(void);
+/* Per-function cost of -fstack-protector-strong and the -finstrument-functions limit check */
+void Bench_StackChecks(void);
+
+#endif
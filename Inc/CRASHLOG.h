@@ -0,0 +1,16 @@
+#ifndef CRASHLOG_H_
+#define CRASHLOG_H_
+
+#include <stdint.h>
+#include "FAULT.h"
+
+/* Append-only log of crash records in flash sector 1 (linker region CRASHLOG) */
+#define CRASHLOG_SECTOR         1U
+#define CRASHLOG_SLOT_SIZE      sizeof(CrashRecord_t)
+
+void CrashLog_Init(void);
+int CrashLog_Append(const CrashRecord_t *record);
+uint32_t CrashLog_Count(void);
+const CrashRecord_t *CrashLog_Get(uint32_t index);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef FAULT_H_
+#define FAULT_H_
+
+#include <stdint.h>
+
+/* FaultFrame_t flags */
+#define FAULT_FLAG_FRAME_VALID  (1UL << 0)  /* r0-xpsr were read from the stacked frame */
+#define FAULT_FLAG_STACKING     (1UL << 1)  /* MSTKERR/STKERR, the frame was never written */
+#define FAULT_FLAG_UNSTACKING   (1UL << 2)  /* MUNSTKERR/UNSTKERR, the return itself faulted */
+#define FAULT_FLAG_PSP          (1UL << 3)  /* Frame was on PSP */
+#define FAULT_FLAG_FPU_FRAME    (1UL << 4)  /* 26-word FPU-extended frame */
+#define FAULT_FLAG_TRAP         (1UL << 5)  /* Software trap, the code is in bits 8-15 */
+#define FAULT_TRAP_CODE_Pos     8U
+
+/* Software trap codes, raised with FAULT_TRAP() */
+#define FAULT_TRAP_CANARY       1U  /* Canary guard backend found its guard words overwritten */
+#define FAULT_TRAP_STACK_CHK    2U  /* -fstack-protector canary smashed, LR is in the failing function */
+#define FAULT_TRAP_STACK_LIMIT  3U  /* -finstrument-functions entry hook found SP below the MSP guard */
+#define FAULT_TRAP_COMPILER     255U /* __builtin_trap() and other compiler-inserted checks */
+
+/* Report a software-detected error through the fault path, UDF raises a precise UsageFault */
+#define FAULT_TRAP(code)        __asm__ volatile("UDF %0" :: "i"(code))
+
+/* Exception frame as captured by the fault entry stubs */
+typedef struct
+{
+    uint32_t r0;
+    uint32_t r1;
+    uint32_t r2;
+    uint32_t r3;
+    uint32_t r12;
+    uint32_t lr;
+    uint32_t pc;
+    uint32_t xpsr;
+    uint32_t exc_return;    /* LR on fault entry */
+    uint32_t sp;            /* SP of the faulting code, or where stacking failed */
+    uint32_t exception;     /* IPSR, the fault being handled */
+    uint32_t flags;         /* FAULT_FLAG_* */
+} FaultFrame_t;
+
+#define CRASH_RECORD_MAGIC      0x48535243UL    /* "CRSH" */
+
+/* Fixed-size binary crash record, crc is CRC-32 over every word before it */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t cfsr;
+    uint32_t mmfar;
+    uint32_t bfar;
+    uint32_t hfsr;
+    FaultFrame_t frame;
+    uint32_t crc;
+} CrashRecord_t;
+
+/* Fault exceptions run above every application IRQ, those must use this priority or lower */
+#define FAULT_PRIORITY          0U
+#define FAULT_APP_IRQ_PRIORITY  1U
+
+void Fault_Init(void);
+uint32_t Fault_Handler(const FaultFrame_t *frame);
+uint32_t Fault_Crc32(const void *data, uint32_t len);
+void Fault_EmitRecord(const CrashRecord_t *record);
+
+/* Crash record kept in .noinit across the reset, NULL if none or corrupt */
+const CrashRecord_t *StackGuard_GetLastCrash(void);
+void StackGuard_ClearLastCrash(void);
+
+#endif
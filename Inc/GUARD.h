@@ -1,6 +1,149 @@
 #ifndef __GUARD_H__
 #define __GUARD_H__
 
+#include <stdint.h>
+#include "FAULT.h"
+
+#define MPU_REGION_NO_ACCESS    (0x00)
+
+/* Reset_Handler paints the MSP stack with this word, keep it in sync with the startup file */
+#define STACKGUARD_PAINT_PATTERN    0xC5C5C5C5UL
+
+/* Words below the binary-search estimate that HighWater rescans for painted holes */
+#ifndef STACKGUARD_HIGHWATER_WINDOW
+#define STACKGUARD_HIGHWATER_WINDOW 64U
+#endif
+
+/* Early-warning zone above the hard guard, a multiple of 256 bytes so it has sub-regions */
+#define STACKGUARD_WARN_SIZE        256U
+
+/*
+ * Opt-in: the zone takes the bottom of the usable MSP stack, an exception
+ * frame stacked into it can't be resumed and resets the device
+ */
+#ifndef STACKGUARD_WARN_ZONE
+#define STACKGUARD_WARN_ZONE        0
+#endif
+
+/* Elastic stack: a hit on the hard guard moves it down into free heap and resumes */
+#ifndef STACKGUARD_ELASTIC
+#define STACKGUARD_ELASTIC          0
+#endif
+
+/* Heap-top guard above the sbrk break, a power of two of 32 bytes or more */
+#define STACKGUARD_HEAP_GUARD_SIZE  32U
+
+/* Uninitialised heap words mixed into the -fstack-protector canary at boot */
+#define STACKGUARD_SEED_WORDS       16U
+
+/* Solved MPU region, the enabled sub-regions cover the guard bytes below the requested top */
+typedef struct
+{
+    uint32_t rbar;      /* Region base, aligned to the region size */
+    uint32_t size;      /* Region size in bytes, a power of two */
+    uint8_t  srd;       /* Sub-region disable mask */
+    uint32_t covered;   /* Bytes actually guarded, ending at the requested top */
+} StackGuard_Region_t;
+
+/* Guard backends, selectable at run time with StackGuard_SetBackend */
+typedef enum
+{
+    STACKGUARD_BACKEND_MPU = 0,     /* No-access MPU region, traps in MemManage */
+    STACKGUARD_BACKEND_DWT,         /* DWT write watchpoint, traps in DebugMonitor, leaves the MPU free */
+    STACKGUARD_BACKEND_CANARY,      /* Painted guard words checked by StackGuard_Check */
+    STACKGUARD_BACKEND_COUNT
+} StackGuard_Backend_t;
+
+/* A guarded range and the MPU region or DWT comparator holding it */
+typedef struct
+{
+    uint32_t base;      /* Lowest guarded byte */
+    uint32_t size;      /* Guarded bytes */
+    int slot;           /* Region or comparator, -1 while disarmed */
+} StackGuard_Guard_t;
+
+typedef struct
+{
+    const char *name;
+    int (*arm)(StackGuard_Guard_t *guard);
+    void (*disarm)(StackGuard_Guard_t *guard);
+    int (*check)(const StackGuard_Guard_t *guard);  /* NULL when the hardware traps, else 0 or -1 */
+} StackGuard_Backend_Ops_t;
+
+/* Early-warning telemetry, updated by the MemManage handler */
+typedef struct
+{
+    uint32_t hits;      /* Warning sub-regions touched so far */
+    uint32_t deepest;   /* Lowest stack address that hit the zone */
+    uint32_t pc;        /* Instruction that made that access */
+} StackGuard_Warn_t;
+
+/* guard_size 0 takes the linker's _Stack_Guard_Size, any other value must match it */
 void StackGuard_Init(uint32_t guard_size);
+/* Lowest byte of the hard guard, _sbrk never grows past it */
+uint32_t StackGuard_GetLimit(void);
+
+/* MPU region manager, regions are handed out from the 8 Cortex-M4 regions */
+int StackGuard_AllocRegion(void);
+void StackGuard_FreeRegion(int region);
+void StackGuard_SetRegion(int region, uint32_t rbar, uint32_t rasr);
+uint32_t StackGuard_EncodeRASR(uint32_t size, uint32_t attributes);
+
+/* Smallest legal region covering guard_size bytes directly below top, returns 0 or -1 */
+int StackGuard_SolveRegion(uint32_t top, uint32_t guard_size, StackGuard_Region_t *region);
+uint32_t StackGuard_RegionRASR(const StackGuard_Region_t *region, uint32_t attributes);
+int StackGuard_AddRegion(const StackGuard_Region_t *region);
+
+/* No-access guard over [base_addr, base_addr + size), returns the region or -1 */
+int StackGuard_AddGuard(uint32_t base_addr, uint32_t size);
+void StackGuard_RemoveGuard(int region);
+
+/* Backend of the MSP guard, switching re-arms the guard with the new backend */
+int StackGuard_SetBackend(StackGuard_Backend_t backend);
+StackGuard_Backend_t StackGuard_GetBackend(void);
+const StackGuard_Backend_Ops_t *StackGuard_GetBackendOps(StackGuard_Backend_t backend);
+/* Polls the canary backend, a broken canary raises FAULT_TRAP_CANARY */
+void StackGuard_Check(void);
+
+/* Benchmark hook, the next hit on guard is timed with DWT->CYCCNT and resumed */
+void StackGuard_SetTrap(StackGuard_Backend_t backend, StackGuard_Guard_t *guard);
+uint32_t StackGuard_GetTrapCycles(void);
+
+/* Heap-top guard, _sbrk moves it with one RBAR/RASR store pair on every break change */
+int StackGuard_AddHeapGuard(void);
+void StackGuard_MoveHeapGuard(uint32_t heap_end);
+
+/* Warning zone over [base_addr, base_addr + size), each hit disarms a sub-region and resumes */
+int StackGuard_AddWarnZone(uint32_t base_addr, uint32_t size);
+const StackGuard_Warn_t *StackGuard_GetWarnStatus(void);
+
+/*
+ * Estimate of the deepest stack use in bytes. A binary search finds a
+ * painted/touched boundary, then the STACKGUARD_HIGHWATER_WINDOW words
+ * below it are rescanned for written words under a painted hole, so the
+ * cost is O(log n) plus the window. A hole left by unwritten locals that
+ * is wider than the window, or a word written with the pattern value
+ * itself, can still make the result under-report.
+ */
+uint32_t StackGuard_HighWater(void);
+uint32_t StackGuard_HighWaterRange(const uint32_t *limit, const uint32_t *top);
+void StackGuard_Paint(uint32_t *limit, uint32_t *top);
+
+/* Trap-and-advance MSP depth profiling for soak tests, result in bytes below _estack */
+int StackGuard_ProfileStart(void);
+void StackGuard_ProfileStop(void);
+uint32_t StackGuard_ProfileResult(uint32_t *pc);
+
+/* -fstack-protector hooks, a smashed canary goes through the fault path as FAULT_TRAP_STACK_CHK */
+extern uint32_t __stack_chk_guard;
+void __stack_chk_fail(void) __attribute__((noreturn));
+
+/* -finstrument-functions hooks, a thread-mode MSP frame below the guard top raises FAULT_TRAP_STACK_LIMIT */
+extern uint32_t stackguard_msp_limit;
+void __cyg_profile_func_enter(void *fn, void *site);
+void __cyg_profile_func_exit(void *fn, void *site);
+
+/* Called by Fault_Handler, returns 1 if the fault was a deliberate trap and may resume */
+int StackGuard_OnFault(const FaultFrame_t *frame);
 
 #endif
@@ -0,0 +1,32 @@
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <stdint.h>
+
+/* Integer arguments per LOG() call, each sent as a raw 32-bit word */
+#define LOG_MAX_ARGS        4U
+
+/* Frame: sync, argument count, 16-bit id, arguments, all little endian. ASCII text never holds the sync byte */
+#define LOG_FRAME_SYNC      0x00U
+#define LOG_FRAME_HEADER    4U
+
+/*
+ * Deferred log, the format string stays in the non-allocated .logstr
+ * section of the ELF and only its id and the raw arguments go out over
+ * USART2. Arguments must be integers, cast pointers to uint32_t.
+ * Tools/logdecode.py formats them on the host.
+ */
+#define LOG(fmt, ...)                                                                       \
+    do                                                                                      \
+    {                                                                                       \
+        static const char log_fmt_[] __attribute__((section(".logstr"), used)) = fmt;       \
+        const uint32_t log_args_[] = { 0, ##__VA_ARGS__ };                                  \
+        _Static_assert(sizeof(log_args_) <= ((LOG_MAX_ARGS + 1U) * sizeof(uint32_t)),     \
+                       "LOG() takes at most LOG_MAX_ARGS arguments");                       \
+        Log_Write((uint32_t)log_fmt_, &log_args_[1],                                        \
+                  (sizeof(log_args_) / sizeof(uint32_t)) - 1U);                             \
+    } while (0)
+
+void Log_Write(uint32_t id, const uint32_t *args, uint32_t argc);
+
+#endif
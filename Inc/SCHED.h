@@ -0,0 +1,53 @@
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include <stdint.h>
+#include "stm32f4xx.h"
+
+#define SCHED_MAX_TASKS     8
+#define SCHED_TICK_HZ       1000U
+#define SCHED_GUARD_SIZE    32U
+/* FPU tasks may push a 26-word extended frame, the guard must be larger so a frame can't step over it */
+#define SCHED_FPU_GUARD_SIZE    128U
+
+/* Sched_CreateTask flags */
+#define SCHED_TASK_FPU      (1UL << 0)
+
+/* Task stacks are aligned to the guard size so the guard is one exact MPU region */
+#define SCHED_STACK(name, bytes)        static uint32_t name[(bytes) / 4] __attribute__((aligned(SCHED_GUARD_SIZE)))
+#define SCHED_FPU_STACK(name, bytes)    static uint32_t name[(bytes) / 4] __attribute__((aligned(SCHED_FPU_GUARD_SIZE)))
+
+typedef enum
+{
+    TASK_READY = 0,
+    TASK_DONE
+} TaskState_t;
+
+/* The first four words are read by PendSV_Handler, keep their offsets */
+typedef struct
+{
+    uint32_t *sp;           /* Saved PSP */
+    uint32_t exc_return;    /* EXC_RETURN the task was switched out with */
+    uint32_t guard_rbar;    /* RBAR with VALID and REGION set for the task guard */
+    uint32_t guard_rasr;    /* RASR of the task guard */
+    uint32_t *stack_base;
+    uint32_t stack_size;
+    void (*entry)(void *arg);
+    void *arg;
+    uint32_t guard_size;
+    uint32_t restarts;      /* Times the task was restarted after a fault */
+    TaskState_t state;
+} Task_t;
+
+int Sched_Init(void);
+int Sched_CreateTask(void (*entry)(void *arg), void *arg, uint32_t *stack, uint32_t stack_size, uint32_t flags);
+void Sched_Start(void);
+void Sched_Yield(void);
+uint32_t Sched_GetTicks(void);
+Task_t *Sched_CurrentTask(void);
+uint32_t Sched_TaskHighWater(const Task_t *task);
+
+/* From a fault handler only: reset the faulting task, returns the EXC_RETURN to resume with */
+uint32_t Sched_RestartCurrent(void);
+
+#endif
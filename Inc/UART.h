@@ -4,10 +4,77 @@
 #include <stdint.h>
 #include "stm32f4xx.h"
 
+#ifndef UART_BAUDRATE
+#define UART_BAUDRATE       115200U
+#endif
+
+/* Solved baud rate generator setting */
+typedef struct
+{
+    uint32_t brr;       /* USART_BRR value */
+    uint32_t over8;     /* 1 if oversampling by 8 is needed to reach the rate */
+    uint32_t actual;    /* Baud rate the divider really gives */
+    int32_t error_ppm;  /* (actual - requested) / requested, in parts per million */
+} UART_Baud_t;
+
+/* Transmit engine behind _write */
+#define UART_TX_POLLED      0
+#define UART_TX_DMA         1
+#define UART_TX_IRQ         2   /* TXE interrupt ring, for builds without a free DMA stream */
+#ifndef UART_TX_MODE
+#define UART_TX_MODE        UART_TX_DMA
+#endif
+
+/* Bytes per half of the DMA double buffer */
+#define UART_TX_BUF_SIZE    256U
+
+/* UART_TX_IRQ ring size, a power of two */
+#ifndef UART_TX_RING_SIZE
+#define UART_TX_RING_SIZE   512U
+#endif
+
+/* What UART_TX_IRQ does with a write that doesn't fit the ring */
+#define UART_TX_BLOCK               0   /* Wait for the ring to drain */
+#define UART_TX_DROP_NEWEST         1   /* Discard the rest of the write */
+#define UART_TX_OVERWRITE_OLDEST    2   /* Discard the oldest queued bytes */
+#ifndef UART_TX_POLICY
+#define UART_TX_POLICY      UART_TX_BLOCK
+#endif
+
+typedef struct
+{
+    uint32_t dropped;   /* Bytes lost to the overflow policy */
+    uint32_t peak;      /* Highest buffer occupancy seen, in bytes */
+} UART_TxStats_t;
+
+/* Circular DMA receive buffer, a power of two */
+#ifndef UART_RX_BUF_SIZE
+#define UART_RX_BUF_SIZE    256U
+#endif
+
+/* UART interrupts run below the fault handlers */
+#define UART_IRQ_PRIORITY   2U
+
 void UART2_Init(void);
+/* BRR and OVER8 for baudrate from periph_clk, returns 0 or -1 if the rate is out of reach */
+int Compute_UART_Baud(uint32_t periph_clk, uint32_t baudrate, UART_Baud_t *baud);
+/* Reprograms USART2 from the live PCLK1, result may be NULL. Up to PCLK1 / 8, 2.625 Mbaud at 42 MHz */
+int UART2_SetBaudRate(uint32_t baudrate, UART_Baud_t *result);
+/* Queues len bytes, only blocks while both buffer halves are full */
+uint32_t UART2_TxBuffer(const char *data, uint32_t len);
+/* Waits until everything queued has left the shift register, safe with interrupts masked */
+void UART2_TxFlush(void);
+void UART2_GetTxStats(UART_TxStats_t *stats);
+/* Polled, after anything already queued */
 void UART2_TxChar(char ch);
 void UART2_TxString(char *str);
-uint8_t UART2_RxChar(void);
+/* Zero-copy receive, a view of the next published span, valid until released */
+uint32_t UART2_RxPeek(const uint8_t **data);
+void UART2_RxRelease(uint32_t len);
+/* Times the reader fell a whole buffer behind and lost data */
+uint32_t UART2_RxOverruns(void);
+/* Next received byte, or -1 if none, never blocks */
+int UART2_RxChar(void);
 
 #endif
 
@@ -0,0 +1,128 @@
+#include <stddef.h>
+#include "BENCH.h"
+#include "GUARD.h"
+#include "LOG.h"
+
+#define BENCH_GUARD_SIZE    32U
+
+// Scratch guard, aligned so every backend can cover it exactly
+static volatile uint32_t bench_buf[BENCH_GUARD_SIZE / 4U] __attribute__((aligned(BENCH_GUARD_SIZE)));
+
+void Bench_Init(void)
+{
+    // CYCCNT counts core clocks, it needs the trace block powered
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static void Bench_GuardInit(StackGuard_Guard_t *guard)
+{
+    guard->base = (uint32_t)bench_buf;
+    guard->size = sizeof(bench_buf);
+    guard->slot = -1;
+}
+
+static uint32_t Bench_GuardSwitch(const StackGuard_Backend_Ops_t *ops)
+{
+    StackGuard_Guard_t guard;
+    uint32_t total = 0;
+    // A context switch re-arms the guard for the incoming stack, the canary also checks the outgoing one
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        Bench_GuardInit(&guard);
+        uint32_t start = DWT->CYCCNT;
+        if (ops->arm(&guard) < 0)
+        {
+            return BENCH_FAILED;
+        }
+        if (ops->check != NULL)
+        {
+            (void)ops->check(&guard);
+        }
+        total += DWT->CYCCNT - start;
+        ops->disarm(&guard);
+    }
+    return total / BENCH_ITERATIONS;
+}
+
+static uint32_t Bench_GuardFault(StackGuard_Backend_t backend, const StackGuard_Backend_Ops_t *ops)
+{
+    StackGuard_Guard_t guard;
+    uint32_t start;
+    Bench_GuardInit(&guard);
+    if (ops->arm(&guard) < 0)
+    {
+        return BENCH_FAILED;
+    }
+    if (ops->check != NULL)
+    {
+        // Nothing traps, detection costs the store plus the next poll
+        start = DWT->CYCCNT;
+        bench_buf[0] = 0;
+        int hit = ops->check(&guard);
+        uint32_t cycles = DWT->CYCCNT - start;
+        ops->disarm(&guard);
+        return (hit < 0) ? cycles : BENCH_FAILED;
+    }
+    // The handler stamps CYCCNT on entry, disarms the guard and resumes the store
+    StackGuard_SetTrap(backend, &guard);
+    start = DWT->CYCCNT;
+    bench_buf[0] = 0;
+    // Watchpoint events are asynchronous, let it land before looking at the result
+    __DSB();
+    __ISB();
+    if (guard.slot >= 0)
+    {
+        StackGuard_SetTrap(backend, NULL);
+        ops->disarm(&guard);
+        return BENCH_FAILED;
+    }
+    return StackGuard_GetTrapCycles() - start;
+}
+
+// Same body twice, only the first gets the compiler's stack checks when they are enabled
+__attribute__((noinline)) static uint32_t Bench_CheckedFrame(uint32_t seed)
+{
+    volatile uint8_t buf[16];
+    buf[0] = (uint8_t)seed;
+    return buf[0];
+}
+
+__attribute__((noinline, no_stack_protector, no_instrument_function)) static uint32_t Bench_PlainFrame(uint32_t seed)
+{
+    volatile uint8_t buf[16];
+    buf[0] = (uint8_t)seed;
+    return buf[0];
+}
+
+static uint32_t Bench_CallCycles(uint32_t (*frame)(uint32_t))
+{
+    uint32_t start = DWT->CYCCNT;
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        (void)frame(i);
+    }
+    return (DWT->CYCCNT - start) / BENCH_ITERATIONS;
+}
+
+void Bench_StackChecks(void)
+{
+    uint32_t checked = Bench_CallCycles(Bench_CheckedFrame);
+    uint32_t plain = Bench_CallCycles(Bench_PlainFrame);
+    // Zero unless built with -fstack-protector-strong and/or -finstrument-functions, noise can make it negative
+    int32_t overhead = (int32_t)checked - (int32_t)plain;
+    LOG("[bench] stack checks %d cycles per function (%u vs %u)\n\r", overhead, checked, plain);
+}
+
+void Bench_GuardBackends(void)
+{
+    LOG("[bench] backend  switch  fault (cycles)\n\r");
+    for (int backend = 0; backend < STACKGUARD_BACKEND_COUNT; backend++)
+    {
+        const StackGuard_Backend_Ops_t *ops = StackGuard_GetBackendOps((StackGuard_Backend_t)backend);
+        uint32_t switch_cycles = Bench_GuardSwitch(ops);
+        uint32_t fault_cycles = Bench_GuardFault((StackGuard_Backend_t)backend, ops);
+        LOG("[bench] %-7u %7u %6u\n\r", backend, switch_cycles, fault_cycles);
+    }
+}
@@ -0,0 +1,144 @@
+#include <stddef.h>
+#include "stm32f4xx.h"
+#include "CRASHLOG.h"
+
+#define FLASH_KEY1              0x45670123U
+#define FLASH_KEY2              0xCDEF89ABU
+#define FLASH_ERASED            0xFFFFFFFFU
+#define FLASH_SR_ERRORS         (FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR)
+#define CRASHLOG_SLOT_WORDS     (CRASHLOG_SLOT_SIZE / 4U)
+
+extern uint32_t _scrashlog;
+extern uint32_t _ecrashlog;
+
+// Index of the first erased slot, found once at boot so the fault path never scans
+static uint32_t next_slot;
+static uint8_t crashlog_ready;
+
+static uint32_t CrashLog_Slots(void)
+{
+    return ((uint32_t)&_ecrashlog - (uint32_t)&_scrashlog) / CRASHLOG_SLOT_SIZE;
+}
+
+static const uint32_t *CrashLog_Slot(uint32_t index)
+{
+    return &_scrashlog + (index * CRASHLOG_SLOT_WORDS);
+}
+
+static int CrashLog_SlotErased(uint32_t index)
+{
+    const uint32_t *slot = CrashLog_Slot(index);
+    for (uint32_t i = 0; i < CRASHLOG_SLOT_WORDS; i++)
+    {
+        if (slot[i] != FLASH_ERASED)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void Flash_Unlock(void)
+{
+    while (FLASH->SR & FLASH_SR_BSY);
+    if (FLASH->CR & FLASH_CR_LOCK)
+    {
+        FLASH->KEYR = FLASH_KEY1;
+        FLASH->KEYR = FLASH_KEY2;
+    }
+    // Clear stale error flags, they block the next operation
+    FLASH->SR = FLASH_SR_ERRORS | FLASH_SR_EOP;
+}
+
+static void Flash_Lock(void)
+{
+    FLASH->CR = FLASH_CR_LOCK;
+}
+
+static int Flash_ProgramWord(volatile uint32_t *addr, uint32_t word)
+{
+    // x32 parallelism, valid for 2.7 V to 3.6 V supply
+    FLASH->CR = FLASH_CR_PSIZE_1 | FLASH_CR_PG;
+    *addr = word;
+    while (FLASH->SR & FLASH_SR_BSY);
+    FLASH->CR = 0;
+    return (FLASH->SR & FLASH_SR_ERRORS) ? -1 : 0;
+}
+
+static void Flash_EraseSector(uint32_t sector)
+{
+    FLASH->CR = FLASH_CR_PSIZE_1 | FLASH_CR_SER | (sector << FLASH_CR_SNB_Pos);
+    FLASH->CR |= FLASH_CR_STRT;
+    while (FLASH->SR & FLASH_SR_BSY);
+    FLASH->CR = 0;
+}
+
+void CrashLog_Init(void)
+{
+    uint32_t slots = CrashLog_Slots();
+    next_slot = 0;
+    while ((next_slot < slots) && !CrashLog_SlotErased(next_slot))
+    {
+        next_slot++;
+    }
+    // Wrapped: erase here at boot, never inside the fault path
+    if (next_slot == slots)
+    {
+        Flash_Unlock();
+        Flash_EraseSector(CRASHLOG_SECTOR);
+        Flash_Lock();
+        next_slot = 0;
+    }
+    crashlog_ready = 1;
+    // A crash the fault path could not log is still waiting in .noinit
+    const CrashRecord_t *pending = StackGuard_GetLastCrash();
+    if (pending != NULL)
+    {
+        const CrashRecord_t *last = CrashLog_Get(CrashLog_Count() - 1U);
+        if ((last == NULL) || (last->crc != pending->crc))
+        {
+            CrashLog_Append(pending);
+        }
+    }
+}
+
+int CrashLog_Append(const CrashRecord_t *record)
+{
+    const uint32_t *words = (const uint32_t *)record;
+    if (!crashlog_ready || (next_slot >= CrashLog_Slots()))
+    {
+        return -1;
+    }
+    volatile uint32_t *slot = (volatile uint32_t *)CrashLog_Slot(next_slot);
+    next_slot++;
+    Flash_Unlock();
+    // Magic goes last, a slot torn by a reset mid-write never looks valid
+    int status = 0;
+    for (uint32_t i = 1; i < CRASHLOG_SLOT_WORDS; i++)
+    {
+        status |= Flash_ProgramWord(&slot[i], words[i]);
+    }
+    status |= Flash_ProgramWord(&slot[0], words[0]);
+    Flash_Lock();
+    return status;
+}
+
+uint32_t CrashLog_Count(void)
+{
+    return next_slot;
+}
+
+const CrashRecord_t *CrashLog_Get(uint32_t index)
+{
+    if (index >= next_slot)
+    {
+        return NULL;
+    }
+    const CrashRecord_t *record = (const CrashRecord_t *)CrashLog_Slot(index);
+    if ((record->magic != CRASH_RECORD_MAGIC) ||
+        (record->crc != Fault_Crc32(record, offsetof(CrashRecord_t, crc))))
+    {
+        return NULL;
+    }
+    return record;
+}
@@ -0,0 +1,266 @@
+#include <stddef.h>
+#include "stm32f4xx.h"
+#include "core_cm4.h"
+#include "FAULT.h"
+#include "UART.h"
+#include "CRASHLOG.h"
+#include "SCHED.h"
+#include "GUARD.h"
+
+#define FAULT_SRAM_END          (SRAM1_BASE + (96U * 1024U))
+#define FAULT_FRAME_WORDS       8U
+#define FAULT_FPU_FRAME_WORDS   26U
+#define FAULT_XPSR_ALIGNED      (1UL << 9)
+#define EXC_RETURN_SPSEL        (1UL << 2)
+#define EXC_RETURN_FTYPE        (1UL << 4)
+#define EXC_RETURN_THREAD_PSP_BITS ((1UL << 3) | (1UL << 2))
+
+/* Set to 0 to reset on every fault, even those contained to a PSP task */
+#ifndef FAULT_TASK_RECOVERY
+#define FAULT_TASK_RECOVERY     1
+#endif
+#define FAULT_INVALID           0xFFFFFFFFU
+#define FAULT_UDF_OPCODE        0xDE00U
+
+/* Set to 1 to also push the record out of USART2 from inside the fault path */
+#ifndef FAULT_EMIT_ON_FAULT
+#define FAULT_EMIT_ON_FAULT     0
+#endif
+
+// Survives NVIC_SystemReset, validated by magic and CRC on the next boot
+static CrashRecord_t last_crash __attribute__((section(".noinit")));
+
+/*
+ * Fault entry stub, runs before any C code. It picks the stack the frame
+ * was pushed to from EXC_RETURN, then moves MSP to the dedicated fault
+ * stack so nothing is ever pushed to the overflowed stack. If the handler
+ * recovers, MSP is restored and the returned EXC_RETURN resumes execution.
+ */
+#define FAULT_ENTRY_STUB()                          \
+    __asm__ volatile(                               \
+        "TST   LR, #4                   \n"         \
+        "ITE   EQ                       \n"         \
+        "MRSEQ R0, MSP                  \n"         \
+        "MRSNE R0, PSP                  \n"         \
+        "MOV   R1, LR                   \n"         \
+        "MRS   R3, MSP                  \n"         \
+        "LDR   R2, =__FaultStackTop     \n"         \
+        "MSR   MSP, R2                  \n"         \
+        "PUSH  {R3, LR}                 \n"         \
+        "BL    Fault_Entry              \n"         \
+        "POP   {R3, R1}                 \n"         \
+        "MSR   MSP, R3                  \n"         \
+        "BX    R0                       \n")
+
+uint32_t Fault_Crc32(const void *data, uint32_t len)
+{
+    // Bitwise CRC-32 (IEEE 802.3), no table so it costs no flash or RAM
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xFFFFFFFFU;
+    while (len--)
+    {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1U)));
+        }
+    }
+    return ~crc;
+}
+
+static void Fault_TxHex32(uint32_t value)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    for (int shift = 28; shift >= 0; shift -= 4)
+    {
+        UART2_TxChar(hex[(value >> shift) & 0xFU]);
+    }
+}
+
+static void Fault_TxString(const char *str)
+{
+    // Byte by byte, the buffered UART path may not be able to drain from here
+    while (*str)
+    {
+        UART2_TxChar(*str++);
+    }
+}
+
+void Fault_EmitRecord(const CrashRecord_t *record)
+{
+    // One line, "!CRASH:" followed by every record word as 8 hex digits
+    const uint32_t *words = (const uint32_t *)record;
+    // Polled, drain whatever the DMA still has queued first
+    UART2_TxFlush();
+    Fault_TxString("\n\r!CRASH:");
+    for (uint32_t i = 0; i < (sizeof(CrashRecord_t) / 4U); i++)
+    {
+        Fault_TxHex32(words[i]);
+    }
+    Fault_TxString("\n\r");
+    // Let the last byte leave the shift register before anything resets the UART
+    while (!(USART2->SR & USART_SR_TC));
+}
+
+__attribute__((used)) static uint32_t Fault_Entry(uint32_t *sp, uint32_t exc_return)
+{
+    FaultFrame_t frame;
+    uint32_t addr = (uint32_t)sp;
+    uint32_t cfsr = SCB->CFSR;
+    frame.exc_return = exc_return;
+    frame.sp = addr;
+    frame.exception = __get_IPSR();
+    frame.flags = 0;
+    // EXC_RETURN picked the stack in the entry stub, bit 4 clear means an FPU-extended frame
+    if (exc_return & EXC_RETURN_SPSEL)
+    {
+        frame.flags |= FAULT_FLAG_PSP;
+    }
+    uint32_t frame_bytes = FAULT_FRAME_WORDS * 4U;
+    if (!(exc_return & EXC_RETURN_FTYPE))
+    {
+        frame.flags |= FAULT_FLAG_FPU_FRAME;
+        frame_bytes = FAULT_FPU_FRAME_WORDS * 4U;
+    }
+    // Fast path, the fault hit while stacking or unstacking so no valid frame exists
+    if (cfsr & (SCB_CFSR_MSTKERR_Msk | SCB_CFSR_STKERR_Msk))
+    {
+        frame.flags |= FAULT_FLAG_STACKING;
+    }
+    if (cfsr & (SCB_CFSR_MUNSTKERR_Msk | SCB_CFSR_UNSTKERR_Msk))
+    {
+        frame.flags |= FAULT_FLAG_UNSTACKING;
+    }
+    // The frame is only read back if it exists and still lies in SRAM
+    if (!(frame.flags & (FAULT_FLAG_STACKING | FAULT_FLAG_UNSTACKING)) &&
+        (addr >= SRAM1_BASE) && ((addr + frame_bytes) <= FAULT_SRAM_END))
+    {
+        frame.r0 = sp[0];
+        frame.r1 = sp[1];
+        frame.r2 = sp[2];
+        frame.r3 = sp[3];
+        frame.r12 = sp[4];
+        frame.lr = sp[5];
+        frame.pc = sp[6];
+        frame.xpsr = sp[7];
+        frame.flags |= FAULT_FLAG_FRAME_VALID;
+        // UDF #code from FAULT_TRAP(), the fetch succeeded so the halfword at PC is readable
+        if ((cfsr & SCB_CFSR_UNDEFINSTR_Msk) && ((*(const uint16_t *)(frame.pc & ~1U) & 0xFF00U) == FAULT_UDF_OPCODE))
+        {
+            frame.flags |= FAULT_FLAG_TRAP | ((*(const uint16_t *)(frame.pc & ~1U) & 0xFFU) << FAULT_TRAP_CODE_Pos);
+        }
+        // Report the SP of the interrupted code, xPSR bit 9 flags the alignment word
+        frame.sp = addr + frame_bytes + ((frame.xpsr & FAULT_XPSR_ALIGNED) ? 4U : 0U);
+    }
+    else
+    {
+        frame.r0 = frame.r1 = frame.r2 = frame.r3 = FAULT_INVALID;
+        frame.r12 = frame.lr = frame.pc = frame.xpsr = FAULT_INVALID;
+    }
+    return Fault_Handler(&frame);
+}
+
+void Fault_Init(void)
+{
+    // Without these enables every configurable fault escalates to HardFault
+    SCB->SHCSR |= SCB_SHCSR_MEMFAULTENA_Msk | SCB_SHCSR_BUSFAULTENA_Msk | SCB_SHCSR_USGFAULTENA_Msk;
+    NVIC_SetPriority(MemoryManagement_IRQn, FAULT_PRIORITY);
+    NVIC_SetPriority(BusFault_IRQn, FAULT_PRIORITY);
+    NVIC_SetPriority(UsageFault_IRQn, FAULT_PRIORITY);
+    // Keep device IRQs below the faults so a fault can preempt any of them
+    for (int irq = 0; irq <= (int)SPI4_IRQn; irq++)
+    {
+        if (NVIC_GetPriority((IRQn_Type)irq) < FAULT_APP_IRQ_PRIORITY)
+        {
+            NVIC_SetPriority((IRQn_Type)irq, FAULT_APP_IRQ_PRIORITY);
+        }
+    }
+    __DSB();
+    __ISB();
+}
+
+/*
+ * Single report-and-recover path for MemManage, BusFault, UsageFault,
+ * HardFault and the DWT guard's DebugMonitor. The exception number in the
+ * frame tells them apart. Returns the EXC_RETURN to resume with when the
+ * fault was contained, otherwise resets.
+ */
+uint32_t Fault_Handler(const FaultFrame_t *frame)
+{
+    // Guard traps set on purpose resume the faulting instruction
+    if (StackGuard_OnFault(frame))
+    {
+        __DSB();
+        return frame->exc_return;
+    }
+    CrashRecord_t record;
+    record.magic = CRASH_RECORD_MAGIC;
+    record.cfsr = SCB->CFSR;
+    record.mmfar = SCB->MMFAR;
+    record.bfar = SCB->BFAR;
+    record.hfsr = SCB->HFSR;
+    record.frame = *frame;
+    record.crc = Fault_Crc32(&record, offsetof(CrashRecord_t, crc));
+    last_crash = record;
+    __DSB();
+#if FAULT_TASK_RECOVERY
+    // A fault in a PSP task only takes that task down, restart it and keep the others running
+    if (((frame->exc_return & EXC_RETURN_THREAD_PSP_BITS) == EXC_RETURN_THREAD_PSP_BITS) && (Sched_CurrentTask() != NULL))
+    {
+        uint32_t exc_return = Sched_RestartCurrent();
+        // Status bits are write-one-to-clear
+        SCB->CFSR = record.cfsr;
+        SCB->HFSR = record.hfsr;
+        SCB->DFSR = SCB->DFSR;
+        __DSB();
+        return exc_return;
+    }
+#endif
+    // Word-programmed into an already erased slot, no sector erase here
+    CrashLog_Append(&record);
+#if FAULT_EMIT_ON_FAULT
+    Fault_EmitRecord(&record);
+#endif
+    NVIC_SystemReset();
+}
+
+const CrashRecord_t *StackGuard_GetLastCrash(void)
+{
+    if ((last_crash.magic != CRASH_RECORD_MAGIC) ||
+        (last_crash.crc != Fault_Crc32(&last_crash, offsetof(CrashRecord_t, crc))))
+    {
+        return NULL;
+    }
+    return &last_crash;
+}
+
+void StackGuard_ClearLastCrash(void)
+{
+    last_crash.magic = 0;
+}
+
+__attribute__((naked)) void HardFault_Handler(void)
+{
+    FAULT_ENTRY_STUB();
+}
+
+__attribute__((naked)) void MemManage_Handler(void)
+{
+    FAULT_ENTRY_STUB();
+}
+
+__attribute__((naked)) void BusFault_Handler(void)
+{
+    FAULT_ENTRY_STUB();
+}
+
+__attribute__((naked)) void UsageFault_Handler(void)
+{
+    FAULT_ENTRY_STUB();
+}
+
+/* DWT guard backend, a write watchpoint on the guard raises DebugMonitor */
+__attribute__((naked)) void DebugMon_Handler(void)
+{
+    FAULT_ENTRY_STUB();
+}
@@ -1,70 +1,861 @@
 #include "stm32f4xx.h"
 #include "core_cm4.h"
-#include <stdio.h>
+#include <stddef.h>
+#include "LOG.h"
 #include "GUARD.h"
 #include "UART.h"
+#include "FAULT.h"
 
-#define MPU_REGION_NUMBER       0
-#define MPU_REGION_NO_ACCESS    (0x00)
+#define MPU_REGION_COUNT        8
 #define MPU_RASR_ENABLE         (1UL << 0)
+#define MPU_MIN_REGION_SIZE     32U
+#define MPU_MIN_SRD_REGION_SIZE 256U
+#define MPU_SUBREGION_COUNT     8U
+#define PROFILE_GRANULE         MPU_MIN_REGION_SIZE
+#define PROFILE_FRAME_GAP       108U    // Extended FP exception frame plus alignment padding
 
-static void ConfigMPU(uint32_t base_addr, uint32_t size, uint32_t attributes)
+// Bitmap of the MPU regions handed out by StackGuard_AllocRegion
+static volatile uint8_t mpu_regions_used;
+
+#define DWT_FUNCTION_WRITE      0x6U    // Watchpoint on write, a debug event for DebugMonitor
+#define DWT_COMPARATOR_STRIDE   4U      // COMPn, MASKn and FUNCTIONn repeat every 16 bytes
+
+static int StackGuard_MpuArm(StackGuard_Guard_t *guard);
+static void StackGuard_MpuDisarm(StackGuard_Guard_t *guard);
+static int StackGuard_DwtArm(StackGuard_Guard_t *guard);
+static void StackGuard_DwtDisarm(StackGuard_Guard_t *guard);
+static int StackGuard_CanaryArm(StackGuard_Guard_t *guard);
+static void StackGuard_CanaryDisarm(StackGuard_Guard_t *guard);
+static int StackGuard_CanaryCheck(const StackGuard_Guard_t *guard);
+
+static const StackGuard_Backend_Ops_t backend_ops[STACKGUARD_BACKEND_COUNT] =
+{
+    [STACKGUARD_BACKEND_MPU]    = { "MPU",    StackGuard_MpuArm,    StackGuard_MpuDisarm,    NULL },
+    [STACKGUARD_BACKEND_DWT]    = { "DWT",    StackGuard_DwtArm,    StackGuard_DwtDisarm,    NULL },
+    [STACKGUARD_BACKEND_CANARY] = { "Canary", StackGuard_CanaryArm, StackGuard_CanaryDisarm, StackGuard_CanaryCheck },
+};
+
+// Hard guard below the MSP stack, moved down in elastic mode
+static StackGuard_Backend_t guard_backend = STACKGUARD_BACKEND_MPU;
+static StackGuard_Guard_t msp_guard = { 0, 0, -1 };
+// Top of the MSP guard, read by the -finstrument-functions entry check
+uint32_t stackguard_msp_limit;
+
+// Bitmap of the DWT comparators handed out to guards
+static volatile uint8_t dwt_comparators_used;
+
+// One-shot guard armed by the benchmark, a hit on it is timed, disarmed and resumed
+static StackGuard_Guard_t *volatile trap_guard;
+static StackGuard_Backend_t trap_backend;
+static volatile uint32_t trap_cycles;
+
+// No-access region just above the heap break, dropped while it touches the stack guard
+static int heap_guard_region = -1;
+
+// Early-warning zone above the hard guard, disarmed one sub-region at a time
+static int warn_region = -1;
+static StackGuard_Region_t warn;
+static uint32_t warn_armed_top;
+static StackGuard_Warn_t warn_status;
+
+static void ConfigMPU(void)
 {
-	// Enable the MPU peripheral
-    MPU->CTRL = MPU_CTRL_ENABLE_Msk;
-    // Use default Memory Map for Privileged Software execution
-    MPU->CTRL |= MPU_CTRL_PRIVDEFENA_Msk;
+    if (MPU->CTRL & MPU_CTRL_ENABLE_Msk)
+    {
+        return;
+    }
+    // Start from a clean slate, all regions disabled
+    for (uint32_t region = 0; region < MPU_REGION_COUNT; region++)
+    {
+        MPU->RNR = region;
+        MPU->RASR = 0;
+    }
+    // Enable the MPU with the default Memory Map for Privileged Software execution
+    MPU->CTRL = MPU_CTRL_ENABLE_Msk | MPU_CTRL_PRIVDEFENA_Msk;
     // Complete all previous memory operations
     __DSB();
     // Flush the Instruction Pipeline
     __ISB();
-    // Set Memory Region Number
-    MPU->RNR = MPU_REGION_NUMBER;
-    // Set Memory Region Base Address
-    MPU->RBAR = base_addr & MPU_RBAR_ADDR_Msk;
-    // Set Memory Access permissions
-    MPU->RASR |= (attributes << MPU_RASR_AP_Pos);
-    // Set Memory Region Size
-    MPU->RASR |= ((size << MPU_RASR_SIZE_Pos) & MPU_RASR_SIZE_Msk);
-    // Enable Memory Region
-    MPU->RASR |= MPU_RASR_ENABLE;
 }
 
-void StackGuard_Init(uint32_t guard_size) 
+static uint32_t Log2(uint32_t value)
+{
+    return 31U - __CLZ(value);
+}
+
+uint32_t StackGuard_EncodeRASR(uint32_t size, uint32_t attributes)
+{
+    // RASR.SIZE holds log2(size) - 1, regions are at least 32 bytes
+    if (size < MPU_MIN_REGION_SIZE)
+    {
+        size = MPU_MIN_REGION_SIZE;
+    }
+    return ((Log2(size) - 1U) << MPU_RASR_SIZE_Pos) |
+           ((attributes << MPU_RASR_AP_Pos) & MPU_RASR_AP_Msk) |
+           MPU_RASR_XN_Msk |
+           MPU_RASR_ENABLE;
+}
+
+int StackGuard_AllocRegion(void)
+{
+    int region = -1;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    // Higher numbered regions win on overlap, hand those out first
+    for (int i = MPU_REGION_COUNT - 1; i >= 0; i--)
+    {
+        if (!(mpu_regions_used & (1U << i)))
+        {
+            mpu_regions_used |= (1U << i);
+            region = i;
+            break;
+        }
+    }
+    // The MPU is only switched on once a region is actually owned
+    if (region >= 0)
+    {
+        ConfigMPU();
+    }
+    __set_PRIMASK(primask);
+    return region;
+}
+
+void StackGuard_SetRegion(int region, uint32_t rbar, uint32_t rasr)
+{
+    // RBAR.VALID selects the region, so the update is a single RBAR/RASR store pair.
+    // PendSV rewrites RNR with its own pair, so it must not land in between.
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    MPU->RBAR = (rbar & MPU_RBAR_ADDR_Msk) | MPU_RBAR_VALID_Msk | ((uint32_t)region & MPU_RBAR_REGION_Msk);
+    MPU->RASR = rasr;
+    __DSB();
+    __ISB();
+    __set_PRIMASK(primask);
+}
+
+void StackGuard_FreeRegion(int region)
+{
+    if ((region < 0) || (region >= MPU_REGION_COUNT))
+    {
+        return;
+    }
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    // Disable only this region, the MPU and every other region stay live
+    MPU->RNR = (uint32_t)region;
+    MPU->RASR = 0;
+    __DSB();
+    __ISB();
+    mpu_regions_used &= ~(1U << region);
+    __set_PRIMASK(primask);
+}
+
+int StackGuard_SolveRegion(uint32_t top, uint32_t guard_size, StackGuard_Region_t *region)
+{
+    uint32_t best_covered = 0;
+    // The guard ends at top, keep it off the usable stack by rounding down
+    top &= ~(MPU_MIN_REGION_SIZE - 1U);
+    if ((guard_size == 0) || (guard_size > top))
+    {
+        return -1;
+    }
+    for (uint32_t log2 = 5; log2 < 32; log2++)
+    {
+        uint32_t size = 1UL << log2;
+        uint32_t sub = size / MPU_SUBREGION_COUNT;
+        uint32_t covered, base;
+        uint8_t srd = 0;
+        // Every candidate covers at least one sub-region, no smaller waste is left to find
+        if ((best_covered != 0) && (sub >= best_covered))
+        {
+            break;
+        }
+        if (size < guard_size)
+        {
+            continue;
+        }
+        if (size < MPU_MIN_SRD_REGION_SIZE)
+        {
+            // Sub-regions are not supported below 256 bytes, the whole region is the guard
+            covered = size;
+            base = top - size;
+            if (base & (size - 1U))
+            {
+                continue;
+            }
+        }
+        else
+        {
+            // Trim the region to 1/8 granularity with the sub-region disable bits
+            if (top & (sub - 1U))
+            {
+                continue;
+            }
+            covered = (guard_size + sub - 1U) & ~(sub - 1U);
+            base = (top - covered) & ~(size - 1U);
+            if ((top - base) > size)
+            {
+                continue;
+            }
+            uint32_t first = (top - covered - base) / sub;
+            uint32_t last = (top - base) / sub;
+            for (uint32_t i = 0; i < MPU_SUBREGION_COUNT; i++)
+            {
+                if ((i < first) || (i >= last))
+                {
+                    srd |= (uint8_t)(1U << i);
+                }
+            }
+        }
+        if ((best_covered == 0) || (covered < best_covered))
+        {
+            best_covered = covered;
+            region->rbar = base;
+            region->size = size;
+            region->srd = srd;
+            region->covered = covered;
+        }
+    }
+    return (best_covered != 0) ? 0 : -1;
+}
+
+uint32_t StackGuard_RegionRASR(const StackGuard_Region_t *region, uint32_t attributes)
+{
+    return StackGuard_EncodeRASR(region->size, attributes) |
+           (((uint32_t)region->srd << MPU_RASR_SRD_Pos) & MPU_RASR_SRD_Msk);
+}
+
+int StackGuard_AddRegion(const StackGuard_Region_t *region)
+{
+    int number = StackGuard_AllocRegion();
+    if (number < 0)
+    {
+        return -1;
+    }
+    StackGuard_SetRegion(number, region->rbar, StackGuard_RegionRASR(region, MPU_REGION_NO_ACCESS));
+    return number;
+}
+
+int StackGuard_AddGuard(uint32_t base_addr, uint32_t size)
+{
+    StackGuard_Region_t region;
+    // Solve for the smallest legal region ending at the top of the requested guard
+    if (StackGuard_SolveRegion(base_addr + size, size, &region) < 0)
+    {
+        return -1;
+    }
+    return StackGuard_AddRegion(&region);
+}
+
+void StackGuard_RemoveGuard(int region)
+{
+    StackGuard_FreeRegion(region);
+}
+
+void StackGuard_Paint(uint32_t *limit, uint32_t *top)
+{
+    while (limit < top)
+    {
+        *limit++ = STACKGUARD_PAINT_PATTERN;
+    }
+}
+
+uint32_t StackGuard_HighWaterRange(const uint32_t *limit, const uint32_t *top)
+{
+    // Binary search for the painted/touched boundary, a first estimate only
+    uint32_t lo = 0;
+    uint32_t hi = (uint32_t)(top - limit);
+    while (lo < hi)
+    {
+        uint32_t mid = lo + ((hi - lo) / 2U);
+        if (limit[mid] == STACKGUARD_PAINT_PATTERN)
+        {
+            lo = mid + 1U;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    // Never-written locals leave painted holes inside used stack, the search can land in
+    // one and stop above the real low point. Rescan a bounded window below the estimate.
+    uint32_t start = (lo > STACKGUARD_HIGHWATER_WINDOW) ? (lo - STACKGUARD_HIGHWATER_WINDOW) : 0U;
+    for (uint32_t i = start; i < lo; i++)
+    {
+        if (limit[i] != STACKGUARD_PAINT_PATTERN)
+        {
+            lo = i;
+            break;
+        }
+    }
+    return (uint32_t)(top - limit - lo) * 4U;
+}
+
+uint32_t StackGuard_HighWater(void)
+{
+    extern uint32_t _sstack;
+    extern uint32_t _estack;
+    // Armed warning sub-regions are untouched by definition, and reading them would trap
+    uint32_t *limit = (warn_armed_top > (uint32_t)&_sstack) ? (uint32_t *)warn_armed_top : &_sstack;
+    return StackGuard_HighWaterRange(limit, &_estack);
+}
+
+void StackGuard_Init(uint32_t guard_size)
 {
 	UART2_Init();
-	// Calculate Guard buffer size
+	// The MSP stack descends towards _sstack, the guard sits directly below it
+    extern uint32_t _sstack;
+    extern uint32_t _Stack_Guard_Size;
+    // Guard hits must reach MemManage_Handler/BusFault_Handler, not the HardFault escalation
+    Fault_Init();
+    if ((uint32_t)&_Stack_Guard_Size == 0)
+    {
+        // Stack at the bottom of SRAM, an overflow runs off the start of RAM into a BusFault
+        LOG("[info] Stack at bottom of RAM, no MPU Region needed\n\r");
+        return;
+    }
+    // The linker reserved and aligned exactly _Stack_Guard_Size bytes, and the heap stops below them
+    if (guard_size == 0)
+    {
+        guard_size = (uint32_t)&_Stack_Guard_Size;
+    }
+    else if (guard_size != (uint32_t)&_Stack_Guard_Size)
+    {
+        LOG("[error] Guard size %u does not match _Stack_Guard_Size %u\n\r", guard_size, (uint32_t)&_Stack_Guard_Size);
+        return;
+    }
+    // Configure Guard Buffer with the selected backend
+    msp_guard.base = (uint32_t)&_sstack - guard_size;
+    msp_guard.size = guard_size;
+    if (backend_ops[guard_backend].arm(&msp_guard) < 0)
+    {
+        LOG("[error] No resource available for Guard on backend %u\n\r", guard_backend);
+        return;
+    }
+    stackguard_msp_limit = msp_guard.base + msp_guard.size;
+    LOG("[info] Configured Guard with backend %u\n\r", guard_backend);
+    // The warning zone and heap guard are MPU regions, the other backends leave the MPU free
+#if STACKGUARD_WARN_ZONE
+    if ((guard_backend == STACKGUARD_BACKEND_MPU) &&
+        (StackGuard_AddWarnZone((uint32_t)&_sstack, STACKGUARD_WARN_SIZE) < 0))
+    {
+        LOG("[error] No MPU Region available for Warning Zone\n\r");
+    }
+#endif
+    if ((guard_backend == STACKGUARD_BACKEND_MPU) && (StackGuard_AddHeapGuard() < 0))
+    {
+        LOG("[error] No MPU Region available for Heap Guard\n\r");
+    }
+}
+
+int StackGuard_AddHeapGuard(void)
+{
+    extern uint8_t *sbrk_heap_end(void);
+    if (heap_guard_region < 0)
+    {
+        heap_guard_region = StackGuard_AllocRegion();
+        if (heap_guard_region < 0)
+        {
+            return -1;
+        }
+    }
+    StackGuard_MoveHeapGuard((uint32_t)sbrk_heap_end());
+    return heap_guard_region;
+}
+
+void StackGuard_MoveHeapGuard(uint32_t heap_end)
+{
+    if (heap_guard_region < 0)
+    {
+        return;
+    }
+    uint32_t base = (heap_end + STACKGUARD_HEAP_GUARD_SIZE - 1U) & ~(STACKGUARD_HEAP_GUARD_SIZE - 1U);
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    // Adjacent to the stack guard the two merge, that one already covers the gap
+    uint32_t rasr = ((base + STACKGUARD_HEAP_GUARD_SIZE) > StackGuard_GetLimit()) ? 0U :
+                    StackGuard_EncodeRASR(STACKGUARD_HEAP_GUARD_SIZE, MPU_REGION_NO_ACCESS);
+    StackGuard_SetRegion(heap_guard_region, base, rasr);
+    __set_PRIMASK(primask);
+}
+
+uint32_t StackGuard_GetLimit(void)
+{
+    extern uint32_t _heap_limit;
+    // Lowest guarded byte, the heap must stay below it
+    return (msp_guard.slot < 0) ? (uint32_t)&_heap_limit : msp_guard.base;
+}
+
+const StackGuard_Backend_Ops_t *StackGuard_GetBackendOps(StackGuard_Backend_t backend)
+{
+    return ((uint32_t)backend < STACKGUARD_BACKEND_COUNT) ? &backend_ops[backend] : NULL;
+}
+
+StackGuard_Backend_t StackGuard_GetBackend(void)
+{
+    return guard_backend;
+}
+
+int StackGuard_SetBackend(StackGuard_Backend_t backend)
+{
+    if ((uint32_t)backend >= STACKGUARD_BACKEND_COUNT)
+    {
+        return -1;
+    }
+    // Before StackGuard_Init this only picks the backend it will arm
+    if (msp_guard.slot >= 0)
+    {
+        backend_ops[guard_backend].disarm(&msp_guard);
+        if (backend_ops[backend].arm(&msp_guard) < 0)
+        {
+            // Keep the stack guarded by the backend that worked
+            (void)backend_ops[guard_backend].arm(&msp_guard);
+            return -1;
+        }
+        stackguard_msp_limit = msp_guard.base + msp_guard.size;
+    }
+    guard_backend = backend;
+    return 0;
+}
+
+void StackGuard_Check(void)
+{
+    const StackGuard_Backend_Ops_t *ops = &backend_ops[guard_backend];
+    // Hardware backends trap on their own, only the canary has to be polled
+    if ((ops->check != NULL) && (msp_guard.slot >= 0) && (ops->check(&msp_guard) < 0))
+    {
+        FAULT_TRAP(FAULT_TRAP_CANARY);
+    }
+}
+
+static int StackGuard_MpuArm(StackGuard_Guard_t *guard)
+{
+    StackGuard_Region_t region;
+    uint32_t top = (guard->base + guard->size) & ~(MPU_MIN_REGION_SIZE - 1U);
+    if (StackGuard_SolveRegion(top, guard->size, &region) < 0)
+    {
+        return -1;
+    }
+    guard->slot = StackGuard_AddRegion(&region);
+    // The solver may widen the guard to its sub-region granularity
+    guard->base = top - region.covered;
+    guard->size = region.covered;
+    return (guard->slot < 0) ? -1 : 0;
+}
+
+static void StackGuard_MpuDisarm(StackGuard_Guard_t *guard)
+{
+    StackGuard_FreeRegion(guard->slot);
+    guard->slot = -1;
+}
+
+static volatile uint32_t *StackGuard_DwtComparator(int comparator)
+{
+    return &DWT->COMP0 + ((uint32_t)comparator * DWT_COMPARATOR_STRIDE);
+}
+
+static int StackGuard_DwtArm(StackGuard_Guard_t *guard)
+{
+    int comparator = -1;
+    // A comparator matches an aligned power-of-two range, MASK ignores the low address bits
+    if ((guard->size < 4U) || (guard->size & (guard->size - 1U)) || (guard->base & (guard->size - 1U)))
+    {
+        return -1;
+    }
+    // Without MON_EN the watchpoint has nowhere to go, with a debugger attached it halts instead
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk | CoreDebug_DEMCR_MON_EN_Msk;
+    uint32_t count = (DWT->CTRL & DWT_CTRL_NUMCOMP_Msk) >> DWT_CTRL_NUMCOMP_Pos;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!(dwt_comparators_used & (1U << i)))
+        {
+            dwt_comparators_used |= (uint8_t)(1U << i);
+            comparator = (int)i;
+            break;
+        }
+    }
+    __set_PRIMASK(primask);
+    if (comparator < 0)
+    {
+        return -1;
+    }
+    volatile uint32_t *regs = StackGuard_DwtComparator(comparator);
+    regs[0] = guard->base;
+    regs[1] = Log2(guard->size);
+    // MASK is implementation defined in width, a range it can't hold reads back smaller
+    if (regs[1] != Log2(guard->size))
+    {
+        dwt_comparators_used &= (uint8_t)~(1U << comparator);
+        return -1;
+    }
+    NVIC_SetPriority(DebugMonitor_IRQn, FAULT_PRIORITY);
+    regs[2] = DWT_FUNCTION_WRITE;
+    guard->slot = comparator;
+    return 0;
+}
+
+static void StackGuard_DwtDisarm(StackGuard_Guard_t *guard)
+{
+    if (guard->slot < 0)
+    {
+        return;
+    }
+    StackGuard_DwtComparator(guard->slot)[2] = 0;
+    dwt_comparators_used &= (uint8_t)~(1U << guard->slot);
+    guard->slot = -1;
+}
+
+static int StackGuard_CanaryArm(StackGuard_Guard_t *guard)
+{
+    StackGuard_Paint((uint32_t *)guard->base, (uint32_t *)(guard->base + guard->size));
+    guard->slot = 0;
+    return 0;
+}
+
+static void StackGuard_CanaryDisarm(StackGuard_Guard_t *guard)
+{
+    guard->slot = -1;
+}
+
+static int StackGuard_CanaryCheck(const StackGuard_Guard_t *guard)
+{
+    // Any word that lost the pattern means the stack ran through the guard
+    const uint32_t *word = (const uint32_t *)guard->base;
+    const uint32_t *end = (const uint32_t *)(guard->base + guard->size);
+    while (word < end)
+    {
+        if (*word++ != STACKGUARD_PAINT_PATTERN)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void StackGuard_SetTrap(StackGuard_Backend_t backend, StackGuard_Guard_t *guard)
+{
+    trap_backend = backend;
+    trap_guard = guard;
+    __DSB();
+}
+
+uint32_t StackGuard_GetTrapCycles(void)
+{
+    return trap_cycles;
+}
+
+static int StackGuard_TrapFault(const FaultFrame_t *frame, uint32_t cfsr, uint32_t addr)
+{
+    uint32_t now = DWT->CYCCNT;
+    StackGuard_Guard_t *guard = trap_guard;
+    if ((guard == NULL) || (guard->slot < 0))
+    {
+        return 0;
+    }
+    if (trap_backend == STACKGUARD_BACKEND_MPU)
+    {
+        if ((frame->exception != (MemoryManagement_IRQn + 16)) || !(cfsr & SCB_CFSR_MMARVALID_Msk) ||
+            (addr < guard->base) || (addr >= (guard->base + guard->size)))
+        {
+            return 0;
+        }
+    }
+    else if (trap_backend == STACKGUARD_BACKEND_DWT)
+    {
+        // MATCHED clears on read, it tells this comparator apart from the stack guard's
+        if ((frame->exception != (DebugMonitor_IRQn + 16)) ||
+            !(StackGuard_DwtComparator(guard->slot)[2] & DWT_FUNCTION_MATCHED_Msk))
+        {
+            return 0;
+        }
+    }
+    else
+    {
+        return 0;
+    }
+    trap_cycles = now;
+    backend_ops[trap_backend].disarm(guard);
+    trap_guard = NULL;
+    return 1;
+}
+
+static int StackGuard_ElasticFault(const FaultFrame_t *frame, uint32_t cfsr, uint32_t addr)
+{
+#if STACKGUARD_ELASTIC
+    extern uint8_t *sbrk_heap_end(void);
+    StackGuard_Region_t region;
+    uint32_t limit = msp_guard.base;
+    // A stacking fault has no frame to resume, that overflow stays fatal
+    if ((guard_backend != STACKGUARD_BACKEND_MPU) || (msp_guard.slot < 0) ||
+        (frame->flags & (FAULT_FLAG_PSP | FAULT_FLAG_STACKING)) ||
+        !(cfsr & SCB_CFSR_MMARVALID_Msk) || (addr < limit) || (addr >= (limit + msp_guard.size)))
+    {
+        return 0;
+    }
+    // _sbrk publishes its break before checking the limit, so this read can't miss a grant
+    uint32_t heap_end = ((uint32_t)sbrk_heap_end() + 7U) & ~7U;
+    if ((StackGuard_SolveRegion(limit, msp_guard.size, &region) < 0) ||
+        (region.rbar < heap_end) || ((limit - region.covered) < heap_end))
+    {
+        return 0;
+    }
+    msp_guard.base = limit - region.covered;
+    msp_guard.size = region.covered;
+    stackguard_msp_limit = limit;
+    StackGuard_SetRegion(msp_guard.slot, region.rbar, StackGuard_RegionRASR(&region, MPU_REGION_NO_ACCESS));
+    // The heap guard may now be adjacent to the stack guard
+    StackGuard_MoveHeapGuard((uint32_t)sbrk_heap_end());
+    return 1;
+#else
+    (void)frame;
+    (void)cfsr;
+    (void)addr;
+    return 0;
+#endif
+}
+
+int StackGuard_AddWarnZone(uint32_t base_addr, uint32_t size)
+{
+    StackGuard_Region_t region;
+    // Sub-regions are what gets disarmed, the region must be large enough to have them
+    if ((StackGuard_SolveRegion(base_addr + size, size, &region) < 0) ||
+        (region.size < MPU_MIN_SRD_REGION_SIZE))
+    {
+        return -1;
+    }
+    if (warn_region < 0)
+    {
+        warn_region = StackGuard_AllocRegion();
+        if (warn_region < 0)
+        {
+            return -1;
+        }
+    }
+    warn = region;
+    warn_armed_top = base_addr + size;
+    StackGuard_SetRegion(warn_region, warn.rbar, StackGuard_RegionRASR(&warn, MPU_REGION_NO_ACCESS));
+    return warn_region;
+}
+
+const StackGuard_Warn_t *StackGuard_GetWarnStatus(void)
+{
+    return &warn_status;
+}
+
+static int StackGuard_WarnFault(const FaultFrame_t *frame, uint32_t cfsr, uint32_t addr)
+{
+    if ((warn_region < 0) || (frame->flags & FAULT_FLAG_PSP))
+    {
+        return 0;
+    }
+    // Stacking into the zone has no frame to return to, note the depth and let it reset
+    if (frame->flags & FAULT_FLAG_STACKING)
+    {
+        if ((frame->sp >= warn.rbar) && (frame->sp < warn_armed_top))
+        {
+            warn_status.deepest = frame->sp;
+        }
+        return 0;
+    }
+    if (!(cfsr & SCB_CFSR_MMARVALID_Msk) || (addr < warn.rbar) || (addr >= warn_armed_top))
+    {
+        return 0;
+    }
+    uint32_t sub = warn.size / MPU_SUBREGION_COUNT;
+    uint32_t index = (addr - warn.rbar) / sub;
+    // Disarm the hit sub-region and every one above it, the armed part stays contiguous
+    for (uint32_t i = index; i < MPU_SUBREGION_COUNT; i++)
+    {
+        warn.srd |= (uint8_t)(1U << i);
+    }
+    warn_armed_top = warn.rbar + (index * sub);
+    warn_status.hits++;
+    warn_status.deepest = addr;
+    warn_status.pc = frame->pc;
+    if (warn.srd == 0xFFU)
+    {
+        // Nothing left to warn about, only the hard guard remains
+        StackGuard_FreeRegion(warn_region);
+        warn_region = -1;
+    }
+    else
+    {
+        StackGuard_SetRegion(warn_region, warn.rbar, StackGuard_RegionRASR(&warn, MPU_REGION_NO_ACCESS));
+    }
+    return 1;
+}
+
+/*
+ * Trap-and-advance profiling: a one-granule no-access region sits one
+ * exception frame below the deepest MSP use so far. Each hit records the
+ * depth and the PC that made it, moves the region below the hit and resumes
+ * the access. The gap lets an interrupt taken at the deepest point stack
+ * its frame without hitting the region, at the price of missing accesses
+ * that stay inside the gap.
+ */
+static int profile_region = -1;
+static uint32_t profile_top;
+static uint32_t profile_deepest;
+static uint32_t profile_pc;
+
+static void StackGuard_ProfileArm(uint32_t deepest)
+{
+    profile_top = (deepest - PROFILE_FRAME_GAP) & ~(PROFILE_GRANULE - 1U);
+    StackGuard_SetRegion(profile_region, profile_top - PROFILE_GRANULE,
+                         StackGuard_EncodeRASR(PROFILE_GRANULE, MPU_REGION_NO_ACCESS));
+}
+
+int StackGuard_ProfileStart(void)
+{
+    if (profile_region < 0)
+    {
+        profile_region = StackGuard_AllocRegion();
+        if (profile_region < 0)
+        {
+            return -1;
+        }
+    }
+    profile_deepest = __get_MSP();
+    profile_pc = 0;
+    StackGuard_ProfileArm(profile_deepest);
+    return 0;
+}
+
+void StackGuard_ProfileStop(void)
+{
+    StackGuard_FreeRegion(profile_region);
+    profile_region = -1;
+}
+
+uint32_t StackGuard_ProfileResult(uint32_t *pc)
+{
     extern uint32_t _estack;
-    uint32_t guard_base = (uint32_t)&_estack - guard_size;
-    // Configure Guard Buffer with Attributes
-    ConfigMPU(guard_base, guard_size, MPU_REGION_NO_ACCESS);
-    printf("[info] Configured Memory Region with MPU\n\r");
-}
-
-void MemManage_Handler(void) 
-{
-	printf("[fault] Executing Fault Handler\n\r");
-    uint32_t original_msp, msp, pc;
-    // Save the current MSP
-    __asm__("MRS %0, MSP" : "=r" (original_msp));
-    // Switch to the fault stack
-    __asm__("LDR R0, =_estack");
-    __asm__("MSR MSP, R0");
-    // Capture MSP and PC from fault context
-    __asm__("MRS %0, MSP" : "=r" (msp));
-    __asm__("LDR %0, [SP, #24]" : "=r" (pc));
-    // Validate and fetch the faulting address
-    uint32_t faulting_address = (SCB->CFSR & SCB_CFSR_MMARVALID_Msk) ? SCB->MMFAR : 0xFFFFFFFF;
-    // Print crash details
-    printf("========== Crash Report ==========\n");
-    printf("Fault Address  : 0x%08X\n", (unsigned int)faulting_address);
-    printf("Fault Status   : 0x%08X\n", (unsigned int)SCB->CFSR);
-    printf("Stack Pointer  : 0x%08X\n", (unsigned int)msp);
-    printf("Program Counter: 0x%08X\n", (unsigned int)pc);
-    printf("==================================\n");
-    // Restore the original MSP
-    __asm__("MSR MSP, %0" :: "r" (original_msp));
-    printf("[fault] Executing System Reset\n\r");
-    // Perform a system reset
-    NVIC_SystemReset();
+    if (pc != NULL)
+    {
+        *pc = profile_pc;
+    }
+    return (profile_deepest != 0) ? ((uint32_t)&_estack - profile_deepest) : 0;
+}
+
+static int StackGuard_ProfileFault(const FaultFrame_t *frame, uint32_t cfsr, uint32_t addr)
+{
+    extern uint32_t _sstack;
+    if ((profile_region < 0) || (frame->flags & FAULT_FLAG_PSP))
+    {
+        return 0;
+    }
+    uint32_t region_base = profile_top - PROFILE_GRANULE;
+    // Stacking into the trap leaves no frame to resume, record the depth and let it reset
+    if (frame->flags & FAULT_FLAG_STACKING)
+    {
+        if ((frame->sp >= region_base) && (frame->sp < profile_top))
+        {
+            profile_deepest = frame->sp;
+        }
+        return 0;
+    }
+    if (!(cfsr & SCB_CFSR_MMARVALID_Msk) || (addr < region_base) || (addr >= profile_top))
+    {
+        return 0;
+    }
+    profile_deepest = addr;
+    profile_pc = frame->pc;
+    // Down at the hard guard the profile is complete, that one stays fatal
+    if (addr <= ((uint32_t)&_sstack + PROFILE_FRAME_GAP + PROFILE_GRANULE))
+    {
+        StackGuard_ProfileStop();
+        return 1;
+    }
+    StackGuard_ProfileArm(addr);
+    return 1;
+}
+
+int StackGuard_OnFault(const FaultFrame_t *frame)
+{
+    uint32_t cfsr = SCB->CFSR;
+    uint32_t addr = SCB->MMFAR;
+    if (StackGuard_TrapFault(frame, cfsr, addr))
+    {
+        // Clear the MemManage and watchpoint status, both write-one-to-clear
+        SCB->CFSR = cfsr & SCB_CFSR_MEMFAULTSR_Msk;
+        SCB->DFSR = SCB_DFSR_DWTTRAP_Msk;
+        return 1;
+    }
+    if (frame->exception != (MemoryManagement_IRQn + 16))
+    {
+        return 0;
+    }
+    if (StackGuard_ProfileFault(frame, cfsr, addr) || StackGuard_WarnFault(frame, cfsr, addr) ||
+        StackGuard_ElasticFault(frame, cfsr, addr))
+    {
+        // Clear the MemManage status, write-one-to-clear
+        SCB->CFSR = cfsr & SCB_CFSR_MEMFAULTSR_Msk;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * -fstack-protector support. The canary is seeded before main from the
+ * SysTick counter and SRAM the startup code never clears. Neither source
+ * is strong, together they still differ per board and per boot.
+ */
+uint32_t __stack_chk_guard = 0xA5C3E1F0UL;
+
+__attribute__((constructor, no_stack_protector, no_instrument_function)) static void StackGuard_SeedCanary(void)
+{
+    extern uint32_t _end;
+    uint32_t seed[STACKGUARD_SEED_WORDS + 1U];
+    // The heap above _end is neither copied nor zeroed, it still holds power-up or pre-reset noise
+    for (uint32_t i = 0; i < STACKGUARD_SEED_WORDS; i++)
+    {
+        seed[i] = (&_end)[i];
+    }
+    seed[STACKGUARD_SEED_WORDS] = SysTick->VAL;
+    uint32_t canary = Fault_Crc32(seed, sizeof(seed)) ^ __stack_chk_guard;
+    // A zero low byte stops string copies from reproducing the canary
+    __stack_chk_guard = canary & ~0xFFUL;
+}
+
+__attribute__((noreturn, no_stack_protector, no_instrument_function)) void __stack_chk_fail(void)
+{
+    // The UsageFault records this PC, the stacked LR points into the smashed function
+    FAULT_TRAP(FAULT_TRAP_STACK_CHK);
+    while (1)
+    {
+    }
+}
+
+/*
+ * Stack-limit check for builds with -finstrument-functions. The hook runs
+ * once the caller's frame is allocated, after the prologue has pushed the
+ * saved registers and (at -O0) spilled the arguments into it, but before
+ * the body runs. A frame that jumps past the guard is caught after those
+ * few stores and before any of its locals are written. Naked so the check
+ * itself pushes nothing. Only thread mode on MSP is checked, handlers and
+ * the fault path run elsewhere or below the guard.
+ */
+__attribute__((naked, no_instrument_function)) void __cyg_profile_func_enter(void *fn, void *site)
+{
+    __asm__ volatile(
+        "MRS   R2, IPSR                     \n"
+        "CBNZ  R2, 1f                       \n"
+        "MRS   R2, CONTROL                  \n"
+        "TST   R2, #2                       \n"   // SPSEL, thread mode on PSP
+        "BNE   1f                           \n"
+        "LDR   R2, =stackguard_msp_limit    \n"
+        "LDR   R2, [R2]                     \n"
+        "CMP   SP, R2                       \n"
+        "BHS   1f                           \n"
+        "UDF   %0                           \n"
+        "1:                                 \n"
+        "BX    LR                           \n"
+        :: "i"(FAULT_TRAP_STACK_LIMIT));
+}
+
+__attribute__((naked, no_instrument_function)) void __cyg_profile_func_exit(void *fn, void *site)
+{
+    __asm__ volatile("BX    LR    \n");
 }
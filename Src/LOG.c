@@ -0,0 +1,15 @@
+#include <string.h>
+#include "LOG.h"
+#include "UART.h"
+
+void Log_Write(uint32_t id, const uint32_t *args, uint32_t argc)
+{
+    uint8_t frame[LOG_FRAME_HEADER + (LOG_MAX_ARGS * sizeof(uint32_t))];
+    frame[0] = LOG_FRAME_SYNC;
+    frame[1] = (uint8_t)argc;
+    frame[2] = (uint8_t)id;
+    frame[3] = (uint8_t)(id >> 8);
+    memcpy(&frame[LOG_FRAME_HEADER], args, argc * sizeof(uint32_t));
+    // One copy into the UART TX buffer, the frame leaves in the background
+    UART2_TxBuffer((const char *)frame, LOG_FRAME_HEADER + (argc * sizeof(uint32_t)));
+}
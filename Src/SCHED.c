@@ -0,0 +1,208 @@
+#include <stddef.h>
+#include "SCHED.h"
+#include "GUARD.h"
+
+#define SCHED_EXC_RETURN_PSP    0xFFFFFFFDU
+#define SCHED_XPSR_THUMB        (1UL << 24)
+#define SCHED_HW_FRAME_WORDS    8
+#define SCHED_SW_FRAME_WORDS    8
+
+_Static_assert(offsetof(Task_t, sp) == 0, "PendSV_Handler expects sp at offset 0");
+_Static_assert(offsetof(Task_t, exc_return) == 4, "PendSV_Handler expects exc_return at offset 4");
+_Static_assert(offsetof(Task_t, guard_rbar) == 8, "PendSV_Handler expects guard_rbar at offset 8");
+_Static_assert(offsetof(Task_t, guard_rasr) == 12, "PendSV_Handler expects guard_rasr at offset 12");
+
+static Task_t tasks[SCHED_MAX_TASKS];
+static uint32_t task_count;
+static volatile uint32_t sched_ticks;
+static int sched_guard_region = -1;
+// Read and written by PendSV_Handler, NULL until the first switch
+Task_t *volatile sched_current;
+
+static void Sched_TaskTrampoline(void)
+{
+    Task_t *task = sched_current;
+    task->entry(task->arg);
+    // A task that returns is parked, the others keep running
+    task->state = TASK_DONE;
+    while (1)
+    {
+        Sched_Yield();
+    }
+}
+
+static void Sched_InitFrame(Task_t *task)
+{
+    uint32_t base = (uint32_t)task->stack_base;
+    // Initial frame as PendSV_Handler unstacks it, top aligned to 8 bytes
+    uint32_t *sp = (uint32_t *)((base + task->stack_size) & ~7U);
+    StackGuard_Paint((uint32_t *)(base + task->guard_size), sp);
+    sp -= SCHED_HW_FRAME_WORDS;
+    sp[0] = (uint32_t)task->arg;                        // R0
+    sp[5] = (uint32_t)Sched_TaskTrampoline;             // LR
+    sp[6] = (uint32_t)Sched_TaskTrampoline & ~1U;       // PC
+    sp[7] = SCHED_XPSR_THUMB;                           // xPSR
+    sp -= SCHED_SW_FRAME_WORDS;                         // R4-R11
+    task->sp = sp;
+    task->exc_return = SCHED_EXC_RETURN_PSP;
+}
+
+int Sched_Init(void)
+{
+    // One MPU region is shared by all tasks and swapped on every context switch
+    sched_guard_region = StackGuard_AllocRegion();
+    return (sched_guard_region < 0) ? -1 : 0;
+}
+
+int Sched_CreateTask(void (*entry)(void *arg), void *arg, uint32_t *stack, uint32_t stack_size, uint32_t flags)
+{
+    StackGuard_Region_t region;
+    uint32_t base = (uint32_t)stack;
+    if ((sched_guard_region < 0) || (task_count >= SCHED_MAX_TASKS))
+    {
+        return -1;
+    }
+    // Only FPU tasks pay for a guard that covers the extended frame
+    uint32_t guard_size = (flags & SCHED_TASK_FPU) ? SCHED_FPU_GUARD_SIZE : SCHED_GUARD_SIZE;
+    // The guard takes the lowest bytes of the stack and must stay inside it
+    if ((StackGuard_SolveRegion(base + guard_size, guard_size, &region) < 0) ||
+        (region.rbar < base) ||
+        (stack_size < (guard_size + (SCHED_HW_FRAME_WORDS + SCHED_SW_FRAME_WORDS) * 4U)))
+    {
+        return -1;
+    }
+    Task_t *task = &tasks[task_count];
+    task->stack_base = stack;
+    task->stack_size = stack_size;
+    task->entry = entry;
+    task->arg = arg;
+    task->guard_size = guard_size;
+    task->state = TASK_READY;
+    task->guard_rbar = (region.rbar & MPU_RBAR_ADDR_Msk) | MPU_RBAR_VALID_Msk | (uint32_t)sched_guard_region;
+    task->guard_rasr = StackGuard_RegionRASR(&region, MPU_REGION_NO_ACCESS);
+    task->restarts = 0;
+    Sched_InitFrame(task);
+    task_count++;
+    return 0;
+}
+
+uint32_t Sched_RestartCurrent(void)
+{
+    Task_t *task = sched_current;
+    task->restarts++;
+    task->state = TASK_READY;
+    Sched_InitFrame(task);
+    // Drop a pending lazy FP save, it would land in the discarded frame
+    FPU->FPCCR &= ~FPU_FPCCR_LSPACT_Msk;
+    // Return from the fault straight into the hardware frame, R4-R11 need no restore
+    __set_PSP((uint32_t)(task->sp + SCHED_SW_FRAME_WORDS));
+    return task->exc_return;
+}
+
+__attribute__((used)) static Task_t *Sched_SelectNext(void)
+{
+    Task_t *current = sched_current;
+    uint32_t index = (current == NULL) ? (task_count - 1U) : (uint32_t)(current - tasks);
+    // Round robin over the ready tasks, stay on the current one if none is ready
+    for (uint32_t i = 1; i <= task_count; i++)
+    {
+        Task_t *task = &tasks[(index + i) % task_count];
+        if (task->state == TASK_READY)
+        {
+            sched_current = task;
+            return task;
+        }
+    }
+    if (current == NULL)
+    {
+        sched_current = &tasks[0];
+    }
+    return sched_current;
+}
+
+void Sched_Start(void)
+{
+    if (task_count == 0)
+    {
+        return;
+    }
+    // The first PendSV has no task to save and returns into the first task on PSP
+    sched_current = NULL;
+    // Context switches run below every other exception
+    NVIC_SetPriority(PendSV_IRQn, 0xFF);
+    NVIC_SetPriority(SysTick_IRQn, 0xFF);
+    // Tick from the live HCLK so a PLL set up in SystemInit keeps the tick rate
+    SystemCoreClockUpdate();
+    SysTick->LOAD = (SystemCoreClock / SCHED_TICK_HZ) - 1U;
+    SysTick->VAL = 0;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk;
+    Sched_Yield();
+    while (1)
+    {
+    }
+}
+
+void Sched_Yield(void)
+{
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    __DSB();
+    __ISB();
+}
+
+uint32_t Sched_GetTicks(void)
+{
+    return sched_ticks;
+}
+
+uint32_t Sched_TaskHighWater(const Task_t *task)
+{
+    uint32_t base = (uint32_t)task->stack_base;
+    return StackGuard_HighWaterRange((const uint32_t *)(base + task->guard_size),
+                                     (const uint32_t *)((base + task->stack_size) & ~7U));
+}
+
+Task_t *Sched_CurrentTask(void)
+{
+    return sched_current;
+}
+
+void SysTick_Handler(void)
+{
+    sched_ticks++;
+    // No-op unless the MSP guard runs on the canary backend
+    StackGuard_Check();
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+__attribute__((naked)) void PendSV_Handler(void)
+{
+    __asm__ volatile(
+        // Save the outgoing task, skipped on the very first switch
+        "MRS      R0, PSP               \n"
+        "LDR      R2, =sched_current    \n"
+        "LDR      R1, [R2]              \n"
+        "CBZ      R1, 1f                \n"
+        "TST      LR, #0x10             \n"
+        "IT       EQ                    \n"
+        "VSTMDBEQ R0!, {S16-S31}        \n"
+        "STMDB    R0!, {R4-R11}         \n"
+        "STR      R0, [R1]              \n"
+        "STR      LR, [R1, #4]          \n"
+        "1:                             \n"
+        "BL       Sched_SelectNext      \n"
+        // Swap the guard region, RBAR and RASR are adjacent so this is one store pair
+        "ADD      R1, R0, #8            \n"
+        "LDM      R1, {R2, R3}          \n"
+        "LDR      R1, =0xE000ED9C       \n"   // MPU->RBAR
+        "STM      R1, {R2, R3}          \n"
+        "DSB                            \n"
+        // Restore the incoming task
+        "LDR      R1, [R0]              \n"
+        "LDR      LR, [R0, #4]          \n"
+        "LDMIA    R1!, {R4-R11}         \n"
+        "TST      LR, #0x10             \n"
+        "IT       EQ                    \n"
+        "VLDMIAEQ R1!, {S16-S31}        \n"
+        "MSR      PSP, R1               \n"
+        "BX       LR                    \n");
+}
@@ -1,10 +1,20 @@
 #include "SYSTICK.h"
+#include "SCHED.h"
 
 void delay_ms(uint32_t ms)
 {
 	uint32_t i;
+	// SysTick belongs to the scheduler once it runs, count its 1 ms ticks instead
+	if (SysTick->CTRL & SysTick_CTRL_TICKINT_Msk)
+	{
+		uint32_t start = Sched_GetTicks();
+		while ((Sched_GetTicks() - start) < ms);
+		return;
+	}
 	SysTick->CTRL |= (1<<0) | (1<<2) ;
-	SysTick->LOAD  = 15999;
+	// 1 ms reload from the live HCLK, like Sched_Start
+	SystemCoreClockUpdate();
+	SysTick->LOAD  = (SystemCoreClock / 1000U) - 1U;
 	for(i=0; i<ms; i++)
 	{
 		while(!(SysTick->CTRL & (1<<16)));
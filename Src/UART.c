@@ -1,23 +1,113 @@
+#include <errno.h>
+#include <string.h>
 #include "UART.h"
 
-#define UART_BAUDRATE	115200
-#define SYS_FREQ		16000000
-#define APB1_CLK		SYS_FREQ
+/* BRR mantissa is 12 bits, oversampling by 8 needs USARTDIV >= 1 */
+#define UART_BRR_MAX		0xFFFFU
+#define UART_DIV_MIN_OVER16	16U
+#define UART_DIV_MIN_OVER8	8U
 
-void UART2_Write(int ch);
+/* USART2_TX request is DMA1 Stream6 Channel4 */
+#define UART_TX_DMA_CHANNEL	4U
+#define UART_TX_DMA_FLAGS	(DMA_HIFCR_CTCIF6 | DMA_HIFCR_CHTIF6 | DMA_HIFCR_CTEIF6 | DMA_HIFCR_CDMEIF6 | DMA_HIFCR_CFEIF6)
 
-static uint16_t Compute_UART_Baud(uint32_t periph_clk, uint32_t baudrate)
+/* USART2_RX request is DMA1 Stream5 Channel4 */
+#define UART_RX_DMA_CHANNEL	4U
+#define UART_RX_DMA_FLAGS	(DMA_HIFCR_CTCIF5 | DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTEIF5 | DMA_HIFCR_CDMEIF5 | DMA_HIFCR_CFEIF5)
+
+static volatile uint8_t uart2_ready;
+
+_Static_assert((UART_RX_BUF_SIZE & (UART_RX_BUF_SIZE - 1U)) == 0, "UART_RX_BUF_SIZE must be a power of two");
+/* Circular RX buffer, free-running counts of bytes published by the IRQs and released by the reader */
+static uint8_t uart_rx_buf[UART_RX_BUF_SIZE];
+static volatile uint32_t uart_rx_head;
+static volatile uint32_t uart_rx_tail;
+static uint32_t uart_rx_dma_pos;
+static volatile uint32_t uart_rx_overruns;
+
+#if UART_TX_MODE == UART_TX_DMA
+/* Double buffer, the DMA drains one half while _write fills the other */
+static uint8_t uart_tx_buf[2][UART_TX_BUF_SIZE];
+static volatile uint32_t uart_tx_fill_len;
+static volatile uint8_t uart_tx_fill;
+static volatile uint8_t uart_tx_busy;
+#elif UART_TX_MODE == UART_TX_IRQ
+_Static_assert((UART_TX_RING_SIZE & (UART_TX_RING_SIZE - 1U)) == 0, "UART_TX_RING_SIZE must be a power of two");
+/* Free-running indices, head is advanced by the writers and tail by USART2_IRQHandler */
+static uint8_t uart_tx_ring[UART_TX_RING_SIZE];
+static volatile uint32_t uart_tx_head;
+static volatile uint32_t uart_tx_tail;
+#endif
+
+static UART_TxStats_t uart_tx_stats;
+
+static uint32_t UART2_GetPclk1(void)
 {
-	return ((periph_clk + (baudrate/2U))/baudrate);
+	/*APB1 runs from HCLK through the PPRE1 prescaler*/
+	SystemCoreClockUpdate();
+	return SystemCoreClock >> APBPrescTable[(RCC->CFGR & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_Pos];
 }
 
-static void UART2_SetBaudRate(uint32_t periph_clk, uint32_t baudrate)
+int Compute_UART_Baud(uint32_t periph_clk, uint32_t baudrate, UART_Baud_t *baud)
 {
-	USART2->BRR = Compute_UART_Baud(periph_clk,baudrate);
+	if (baudrate == 0)
+	{
+		return -1;
+	}
+	/*Baud = periph_clk / div in both modes, div counts 1/16 or 1/8 steps of USARTDIV*/
+	uint32_t div = (uint32_t)(((uint64_t)periph_clk + (baudrate / 2U)) / baudrate);
+	if ((div < UART_DIV_MIN_OVER8) || (div > UART_BRR_MAX))
+	{
+		return -1;
+	}
+	/*Oversampling by 16 tolerates more clock deviation, 8 is only used for rates it can't reach*/
+	if (div >= UART_DIV_MIN_OVER16)
+	{
+		baud->over8 = 0;
+		baud->brr = div;
+	}
+	else
+	{
+		/*3-bit fraction, BRR[3] must stay clear*/
+		baud->over8 = 1;
+		baud->brr = ((div >> 3) << 4) | (div & 0x7U);
+	}
+	baud->actual = periph_clk / div;
+	baud->error_ppm = (int32_t)(((int64_t)baud->actual - (int64_t)baudrate) * 1000000 / (int64_t)baudrate);
+	return 0;
+}
+
+int UART2_SetBaudRate(uint32_t baudrate, UART_Baud_t *result)
+{
+	UART_Baud_t baud;
+	if (Compute_UART_Baud(UART2_GetPclk1(), baudrate, &baud) < 0)
+	{
+		return -1;
+	}
+	/*OVER8 can only change with the USART disabled, let queued bytes finish at the old rate*/
+	uint32_t enabled = USART2->CR1 & USART_CR1_UE;
+	if (enabled)
+	{
+		UART2_TxFlush();
+		USART2->CR1 &= ~USART_CR1_UE;
+	}
+	USART2->CR1 = (USART2->CR1 & ~USART_CR1_OVER8) | (baud.over8 ? USART_CR1_OVER8 : 0U);
+	USART2->BRR = baud.brr;
+	USART2->CR1 |= enabled;
+	if (result != NULL)
+	{
+		*result = baud;
+	}
+	return 0;
 }
 
 void UART2_Init(void)
 {
+	/*Called again by StackGuard_Init, a second init must not cut off a running transfer*/
+	if (uart2_ready)
+	{
+		return;
+	}
 	/*Enable clock access to GPIOA*/
 	RCC->AHB1ENR |= RCC_AHB1ENR_GPIOAEN;
 	/*Enable clock access to UART2*/
@@ -27,16 +117,264 @@ void UART2_Init(void)
 	GPIOA->MODER |=(1U<<5);
 	/*Set PA2 alternate function type to UART_TX(AF07)*/
 	GPIOA->AFR[0] |=(0x7<<8);
-	/*Configure Baud Rate*/
-	UART2_SetBaudRate(APB1_CLK,UART_BAUDRATE);
+	/*Set PA3 mode to alternate function mode */
+	GPIOA->MODER &=~(1U<<6);
+	GPIOA->MODER |=(1U<<7);
+	/*Set PA3 alternate function type to UART_RX(AF07)*/
+	GPIOA->AFR[0] |=(0x7<<12);
+	/*Configure Baud Rate from the live APB1 clock*/
+	UART2_SetBaudRate(UART_BAUDRATE, NULL);
 	/*Configure the Transfer directions*/
 	USART2->CR1 |= (USART_CR1_TE | USART_CR1_RE);
 	/*Enable UART module*/
 	USART2->CR1 |= USART_CR1_UE;
+	/*Enable clock access to DMA1*/
+	RCC->AHB1ENR |= RCC_AHB1ENR_DMA1EN;
+	/*Stream5 Channel4, peripheral to memory, circular, interrupts at half and full*/
+	DMA1_Stream5->CR = 0;
+	while (DMA1_Stream5->CR & DMA_SxCR_EN);
+	DMA1_Stream5->PAR = (uint32_t)&USART2->DR;
+	DMA1_Stream5->M0AR = (uint32_t)uart_rx_buf;
+	DMA1_Stream5->NDTR = UART_RX_BUF_SIZE;
+	DMA1_Stream5->CR = (UART_RX_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_MINC | DMA_SxCR_CIRC |
+	                   DMA_SxCR_HTIE | DMA_SxCR_TCIE;
+	DMA1->HIFCR = UART_RX_DMA_FLAGS;
+	DMA1_Stream5->CR |= DMA_SxCR_EN;
+	USART2->CR3 |= USART_CR3_DMAR;
+	/*An idle line ends a received span*/
+	USART2->CR1 |= USART_CR1_IDLEIE;
+	NVIC_SetPriority(DMA1_Stream5_IRQn, UART_IRQ_PRIORITY);
+	NVIC_EnableIRQ(DMA1_Stream5_IRQn);
+	NVIC_SetPriority(USART2_IRQn, UART_IRQ_PRIORITY);
+	NVIC_EnableIRQ(USART2_IRQn);
+#if UART_TX_MODE == UART_TX_DMA
+	/*Stream6 Channel4, memory to peripheral, byte wide, memory increment*/
+	DMA1_Stream6->CR = 0;
+	while (DMA1_Stream6->CR & DMA_SxCR_EN);
+	DMA1_Stream6->PAR = (uint32_t)&USART2->DR;
+	DMA1_Stream6->CR = (UART_TX_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_MINC |
+	                   DMA_SxCR_DIR_0 | DMA_SxCR_TCIE | DMA_SxCR_TEIE;
+	DMA1->HIFCR = UART_TX_DMA_FLAGS;
+	USART2->CR3 |= USART_CR3_DMAT;
+	NVIC_SetPriority(DMA1_Stream6_IRQn, UART_IRQ_PRIORITY);
+	NVIC_EnableIRQ(DMA1_Stream6_IRQn);
+#endif
+	uart2_ready = 1;
+}
+
+#if UART_TX_MODE == UART_TX_DMA
+/* Interrupts masked by the caller, hands the filled half to an idle DMA stream */
+static void UART2_TxKick(void)
+{
+	if (uart_tx_busy || (uart_tx_fill_len == 0))
+	{
+		return;
+	}
+	DMA1->HIFCR = UART_TX_DMA_FLAGS;
+	DMA1_Stream6->M0AR = (uint32_t)uart_tx_buf[uart_tx_fill];
+	DMA1_Stream6->NDTR = uart_tx_fill_len;
+	uart_tx_fill ^= 1U;
+	uart_tx_fill_len = 0;
+	uart_tx_busy = 1;
+	DMA1_Stream6->CR |= DMA_SxCR_EN;
+}
+
+/* Completion handling, run by the IRQ or polled when the IRQ can't preempt the caller */
+static void UART2_TxService(void)
+{
+	if (DMA1->HISR & (DMA_HISR_TCIF6 | DMA_HISR_TEIF6))
+	{
+		DMA1->HIFCR = UART_TX_DMA_FLAGS;
+		uart_tx_busy = 0;
+		UART2_TxKick();
+	}
+}
+
+void DMA1_Stream6_IRQHandler(void)
+{
+	UART2_TxService();
+}
+#elif UART_TX_MODE == UART_TX_IRQ
+/* Moves one byte to DR, run by the IRQ or polled when the IRQ can't preempt the caller */
+static void UART2_TxService(void)
+{
+	if (!(USART2->SR & USART_SR_TXE))
+	{
+		return;
+	}
+	if (uart_tx_head != uart_tx_tail)
+	{
+		USART2->DR = uart_tx_ring[uart_tx_tail & (UART_TX_RING_SIZE - 1U)];
+		uart_tx_tail++;
+	}
+	else
+	{
+		USART2->CR1 &= ~USART_CR1_TXEIE;
+	}
+}
+#endif
+
+/* Publishes what the DMA wrote since the last call, from the IDLE, half and full interrupts */
+static void UART2_RxUpdate(void)
+{
+	uint32_t pos = UART_RX_BUF_SIZE - DMA1_Stream5->NDTR;
+	if (pos == UART_RX_BUF_SIZE)
+	{
+		pos = 0;
+	}
+	uart_rx_head += (pos - uart_rx_dma_pos) & (UART_RX_BUF_SIZE - 1U);
+	uart_rx_dma_pos = pos;
+	/*The reader fell a whole buffer behind, the oldest bytes are already overwritten*/
+	if ((uart_rx_head - uart_rx_tail) > UART_RX_BUF_SIZE)
+	{
+		uart_rx_tail = uart_rx_head - UART_RX_BUF_SIZE;
+		uart_rx_overruns++;
+	}
+}
+
+void DMA1_Stream5_IRQHandler(void)
+{
+	DMA1->HIFCR = UART_RX_DMA_FLAGS;
+	UART2_RxUpdate();
+}
+
+void USART2_IRQHandler(void)
+{
+	/*IDLE clears by reading SR then DR, the DMA already took the data*/
+	if (USART2->SR & USART_SR_IDLE)
+	{
+		(void)USART2->DR;
+		UART2_RxUpdate();
+	}
+#if UART_TX_MODE == UART_TX_IRQ
+	if (USART2->CR1 & USART_CR1_TXEIE)
+	{
+		UART2_TxService();
+	}
+#endif
+}
+
+static int UART2_TxPending(void)
+{
+#if UART_TX_MODE == UART_TX_DMA
+	return uart_tx_busy || uart_tx_fill_len;
+#elif UART_TX_MODE == UART_TX_IRQ
+	return uart_tx_head != uart_tx_tail;
+#else
+	return 0;
+#endif
+}
+
+void UART2_GetTxStats(UART_TxStats_t *stats)
+{
+	*stats = uart_tx_stats;
+}
+
+uint32_t UART2_TxBuffer(const char *data, uint32_t len)
+{
+#if UART_TX_MODE == UART_TX_DMA
+	uint32_t queued = 0;
+	while (queued < len)
+	{
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		uint32_t space = UART_TX_BUF_SIZE - uart_tx_fill_len;
+		uint32_t count = ((len - queued) < space) ? (len - queued) : space;
+		memcpy(&uart_tx_buf[uart_tx_fill][uart_tx_fill_len], &data[queued], count);
+		uart_tx_fill_len += count;
+		queued += count;
+		if (uart_tx_fill_len > uart_tx_stats.peak)
+		{
+			uart_tx_stats.peak = uart_tx_fill_len;
+		}
+		UART2_TxKick();
+		/*Both halves full, wait for the DMA without relying on its IRQ being able to run*/
+		if (count == 0)
+		{
+			UART2_TxService();
+		}
+		__set_PRIMASK(primask);
+	}
+	return queued;
+#elif UART_TX_MODE == UART_TX_IRQ
+	uint32_t queued = 0;
+	while (queued < len)
+	{
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		uint32_t used = uart_tx_head - uart_tx_tail;
+		if (used < UART_TX_RING_SIZE)
+		{
+			uart_tx_ring[uart_tx_head & (UART_TX_RING_SIZE - 1U)] = (uint8_t)data[queued++];
+			uart_tx_head++;
+			used++;
+		}
+		else if (UART_TX_POLICY == UART_TX_DROP_NEWEST)
+		{
+			/*Keep what is queued, the rest of this write is lost*/
+			uart_tx_stats.dropped += len - queued;
+			queued = len;
+		}
+		else if (UART_TX_POLICY == UART_TX_OVERWRITE_OLDEST)
+		{
+			/*Make room by discarding the oldest unsent byte*/
+			uart_tx_tail++;
+			uart_tx_stats.dropped++;
+		}
+		else
+		{
+			/*Blocking, drain a byte without relying on the IRQ being able to run*/
+			UART2_TxService();
+		}
+		if (used > uart_tx_stats.peak)
+		{
+			uart_tx_stats.peak = used;
+		}
+		USART2->CR1 |= USART_CR1_TXEIE;
+		__set_PRIMASK(primask);
+	}
+	return len;
+#else
+	for (uint32_t i = 0; i < len; i++)
+	{
+		UART2_TxChar(data[i]);
+	}
+	return len;
+#endif
+}
+
+void UART2_TxFlush(void)
+{
+#if UART_TX_MODE == UART_TX_DMA
+	/*Polled so it also drains from the fault path, where the DMA IRQ can't run*/
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	while (uart_tx_busy || uart_tx_fill_len)
+	{
+		UART2_TxKick();
+		UART2_TxService();
+	}
+	__set_PRIMASK(primask);
+#elif UART_TX_MODE == UART_TX_IRQ
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	while (uart_tx_head != uart_tx_tail)
+	{
+		UART2_TxService();
+	}
+	USART2->CR1 &= ~USART_CR1_TXEIE;
+	__set_PRIMASK(primask);
+#endif
+	while (!(USART2->SR & USART_SR_TC));
 }
 
 void UART2_TxChar(char ch)
 {
+	/*Polled bytes go out after anything already queued*/
+	if (UART2_TxPending())
+	{
+		UART2_TxFlush();
+	}
 	/*Wait for Transmit Data Register to be empty*/
 	while(!(USART2->SR & USART_SR_TXE));
 	/*Write to the Transmit Data Register*/
@@ -45,38 +383,83 @@ void UART2_TxChar(char ch)
 
 void UART2_TxString(char *str)
 {
-	while(*str)
+	UART2_TxBuffer(str, strlen(str));
+}
+
+uint32_t UART2_RxPeek(const uint8_t **data)
+{
+	uint32_t tail = uart_rx_tail;
+	uint32_t offset = tail & (UART_RX_BUF_SIZE - 1U);
+	uint32_t len = uart_rx_head - tail;
+	/*Only up to the end of the buffer, the wrapped part is the next span*/
+	if (len > (UART_RX_BUF_SIZE - offset))
+	{
+		len = UART_RX_BUF_SIZE - offset;
+	}
+	*data = &uart_rx_buf[offset];
+	return len;
+}
+
+void UART2_RxRelease(uint32_t len)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	/*An overrun may already have moved the tail past these bytes*/
+	if (len > (uart_rx_head - uart_rx_tail))
 	{
-		UART2_TxChar(*str++);
+		len = uart_rx_head - uart_rx_tail;
 	}
+	uart_rx_tail += len;
+	__set_PRIMASK(primask);
 }
 
-uint8_t UART2_RxChar(void)
+uint32_t UART2_RxOverruns(void)
 {
-	while(!(USART2->SR & (1<<5)));
-	return USART2->DR;
+	return uart_rx_overruns;
+}
+
+int UART2_RxChar(void)
+{
+	const uint8_t *data;
+	if (UART2_RxPeek(&data) == 0)
+	{
+		return -1;
+	}
+	uint8_t ch = data[0];
+	UART2_RxRelease(1);
+	return ch;
 }
 
 int _write(int file, char *ptr, int len)
 {
-    for (int i = 0; i < len; i++)
-    {
-        UART2_TxChar(ptr[i]);
-    }
-    return len;
+    (void)file;
+    // Only a copy into the TX buffer, the DMA or TXE interrupt puts it on the wire
+    return (int)UART2_TxBuffer(ptr, (uint32_t)len);
 }
 
 int _read(int file, char *ptr, int len)
 {
     (void)file;
-    for (int i = 0; i < len; i++)
+    int count = 0;
+    // Never waits, returns what has already arrived up to the end of a line
+    while (count < len)
     {
-        ptr[i] = UART2_RxChar();
-        if (ptr[i] == '\r')
+        int ch = UART2_RxChar();
+        if (ch < 0)
+        {
+            break;
+        }
+        ptr[count++] = (char)ch;
+        if (ch == '\r')
         {
-            ptr[i] = '\n';
+            ptr[count - 1] = '\n';
             break;
         }
     }
-    return len;
+    if (count == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    return count;
 }
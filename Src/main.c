@@ -1,6 +1,11 @@
 #include <stdint.h>
+#include <stddef.h>
 #include "UART.h"
 #include "GUARD.h"
+#include "FAULT.h"
+#include "CRASHLOG.h"
+#include "BENCH.h"
+#include "LOG.h"
 
 void RecursiveFunction(int depth)
 {
@@ -12,8 +17,21 @@ void RecursiveFunction(int depth)
 int main()
 {
 	UART2_Init();
-	printf("Hello World\n\r");
-	StackGuard_Init(128);
+	CrashLog_Init();
+	// Drain the crash record left by the previous reset, if any
+	const CrashRecord_t *crash = StackGuard_GetLastCrash();
+	if (crash != NULL)
+	{
+		Fault_EmitRecord(crash);
+		StackGuard_ClearLastCrash();
+	}
+	LOG("Hello World\n\r");
+	StackGuard_Init(0);
+#if BENCH_ON_BOOT
+	Bench_Init();
+	Bench_GuardBackends();
+	Bench_StackChecks();
+#endif
 	RecursiveFunction(0);
 
 	while(1)
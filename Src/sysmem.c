@@ -23,11 +23,12 @@
 /* Includes */
 #include <errno.h>
 #include <stdint.h>
+#include "GUARD.h"
 
 /**
  * Pointer to the current high watermark of the heap usage
  */
-static uint8_t *__sbrk_heap_end = NULL;
+static uint8_t *volatile __sbrk_heap_end = NULL;
 
 /**
  * @brief _sbrk() allocates memory to the newlib heap and is used by malloc
@@ -35,14 +36,17 @@ static uint8_t *__sbrk_heap_end = NULL;
  *
  * @verbatim
  * ############################################################################
- * #  .data  #  .bss  #       newlib heap       #          MSP stack          #
- * #         #        #                         # Reserved by _Min_Stack_Size #
+ * #  .data  #  .bss  #    newlib heap    # guard #         MSP stack         #
+ * #         #        #                   #       # Reserved _Min_Stack_Size  #
  * ############################################################################
- * ^-- RAM start      ^-- _end                             _estack, RAM end --^
+ * ^-- RAM start      ^-- _end  _sguard -^       ^- _sstack  _estack, RAM end ^
  * @endverbatim
  *
  * This implementation starts allocating at the '_end' linker symbol
  * The '_Min_Stack_Size' linker symbol reserves a memory for the MSP stack
+ * The heap stops at StackGuard_GetLimit(), the MPU guard below the MSP stack,
+ * or '_heap_limit' (the RAM end) when the stack sits at the bottom of RAM.
+ * With STACKGUARD_ELASTIC the guard moves down into free heap on a hit
  * The implementation considers '_estack' linker symbol to be RAM end
  * NOTE: If the MSP stack, at any point during execution, grows larger than the
  * reserved size, please increase the '_Min_Stack_Size'.
@@ -53,10 +57,6 @@ static uint8_t *__sbrk_heap_end = NULL;
 void *_sbrk(ptrdiff_t incr)
 {
   extern uint8_t _end; /* Symbol defined in the linker script */
-  extern uint8_t _estack; /* Symbol defined in the linker script */
-  extern uint32_t _Min_Stack_Size; /* Symbol defined in the linker script */
-  const uint32_t stack_limit = (uint32_t)&_estack - (uint32_t)&_Min_Stack_Size;
-  const uint8_t *max_heap = (uint8_t *)stack_limit;
   uint8_t *prev_heap_end;
 
   /* Initialize heap end at first call */
@@ -65,15 +65,31 @@ void *_sbrk(ptrdiff_t incr)
     __sbrk_heap_end = &_end;
   }
 
-  /* Protect heap from growing into the reserved MSP stack */
-  if (__sbrk_heap_end + incr > max_heap)
+  /* Publish the new break before reading the guard, an elastic guard move
+   * in between then sees it and refuses to cross it */
+  prev_heap_end = __sbrk_heap_end;
+  __sbrk_heap_end = prev_heap_end + incr;
+  __asm__ volatile("dsb" ::: "memory");
+
+  /* Protect heap from growing into the stack guard and reserved MSP stack */
+  if ((uint32_t)__sbrk_heap_end > StackGuard_GetLimit())
   {
+    __sbrk_heap_end = prev_heap_end;
     errno = ENOMEM;
     return (void *)-1;
   }
 
-  prev_heap_end = __sbrk_heap_end;
-  __sbrk_heap_end += incr;
+  /* Keep the heap-top MPU guard right above the new break */
+  StackGuard_MoveHeapGuard((uint32_t)__sbrk_heap_end);
 
   return (void *)prev_heap_end;
 }
+
+/**
+ * @brief Current heap break, read by the elastic stack guard
+ */
+uint8_t *sbrk_heap_end(void)
+{
+  extern uint8_t _end; /* Symbol defined in the linker script */
+  return (NULL == __sbrk_heap_end) ? &_end : __sbrk_heap_end;
+}
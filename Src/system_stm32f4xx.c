@@ -0,0 +1,55 @@
+#include "stm32f4xx.h"
+
+#if !defined(HSI_VALUE)
+#define HSI_VALUE   16000000U
+#endif
+/* NUCLEO-F401RE feeds HSE from the ST-LINK 8 MHz MCO */
+#if !defined(HSE_VALUE)
+#define HSE_VALUE   8000000U
+#endif
+
+/* Core runs from the 16 MHz HSI out of reset */
+uint32_t SystemCoreClock = 16000000U;
+const uint8_t AHBPrescTable[16] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 3, 4, 6, 7, 8, 9};
+const uint8_t APBPrescTable[8] = {0, 0, 0, 0, 1, 2, 3, 4};
+
+/*
+ * Called by Reset_Handler before .data and .bss are set up, so it must not
+ * touch any initialised variable. That includes the stack-limit hook's
+ * stackguard_msp_limit, so it is never instrumented.
+ */
+__attribute__((no_instrument_function)) void SystemInit(void)
+{
+    // CP10/CP11 full access, the build uses -mfpu=fpv4-sp-d16 -mfloat-abi=hard
+    SCB->CPACR |= (3UL << 20) | (3UL << 22);
+    // Automatic FP state preservation with lazy stacking, S0-S15 are only saved if a handler uses the FPU
+    FPU->FPCCR |= FPU_FPCCR_ASPEN_Msk | FPU_FPCCR_LSPEN_Msk;
+    __DSB();
+    __ISB();
+}
+
+/* Recomputes SystemCoreClock (HCLK) from the live RCC configuration */
+__attribute__((no_instrument_function)) void SystemCoreClockUpdate(void)
+{
+    uint32_t sysclk;
+    switch (RCC->CFGR & RCC_CFGR_SWS)
+    {
+    case RCC_CFGR_SWS_HSE:
+        sysclk = HSE_VALUE;
+        break;
+    case RCC_CFGR_SWS_PLL:
+    {
+        // SYSCLK = source / PLLM * PLLN / PLLP
+        uint32_t source = (RCC->PLLCFGR & RCC_PLLCFGR_PLLSRC) ? HSE_VALUE : HSI_VALUE;
+        uint32_t pllm = RCC->PLLCFGR & RCC_PLLCFGR_PLLM;
+        uint32_t plln = (RCC->PLLCFGR & RCC_PLLCFGR_PLLN) >> RCC_PLLCFGR_PLLN_Pos;
+        uint32_t pllp = (((RCC->PLLCFGR & RCC_PLLCFGR_PLLP) >> RCC_PLLCFGR_PLLP_Pos) + 1U) * 2U;
+        sysclk = (uint32_t)(((uint64_t)source * plln) / pllm / pllp);
+        break;
+    }
+    default:
+        sysclk = HSI_VALUE;
+        break;
+    }
+    SystemCoreClock = sysclk >> AHBPrescTable[(RCC->CFGR & RCC_CFGR_HPRE) >> RCC_CFGR_HPRE_Pos];
+}
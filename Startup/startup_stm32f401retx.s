@@ -57,6 +57,23 @@ defined in linker script */
 Reset_Handler:
   ldr   r0, =_estack
   mov   sp, r0          /* set stack pointer */
+
+/* Paint the MSP stack with the watermark pattern (STACKGUARD_PAINT_PATTERN in GUARD.h) */
+  ldr r0, =_sstack
+  ldr r1, =_estack
+  ldr r2, =0xC5C5C5C5
+  mov r3, r2
+  mov r4, r2
+  mov r5, r2
+  b LoopPaintStack
+
+PaintStack:
+  stmia r0!, {r2-r5}
+
+LoopPaintStack:
+  cmp r0, r1
+  bcc PaintStack
+
 /* Call the clock system initialization function.*/
   bl  SystemInit
 
@@ -77,7 +94,7 @@ LoopCopyDataInit:
   cmp r4, r1
   bcc CopyDataInit
 
-/* Zero fill the bss segment. */
+/* Zero fill the bss segment. .noinit lies outside it and keeps its content. */
   ldr r2, =_sbss
   ldr r4, =_ebss
   movs r3, #0
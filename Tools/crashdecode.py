@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Decode StackGuard crash records.
+
+Accepts either a raw dump of the crash log flash sector, e.g.
+    st-flash read crashlog.bin 0x08004000 0x4000
+or a UART capture containing '!CRASH:' lines.
+"""
+import struct
+import sys
+import zlib
+
+MAGIC = 0x48535243
+FIELDS = ("magic", "cfsr", "mmfar", "bfar", "hfsr",
+          "r0", "r1", "r2", "r3", "r12", "lr", "pc", "xpsr",
+          "exc_return", "sp", "exception", "flags", "crc")
+RECORD_WORDS = len(FIELDS)
+RECORD_SIZE = RECORD_WORDS * 4
+
+FRAME_FLAGS = {0: "FRAME_VALID", 1: "STACKING", 2: "UNSTACKING", 3: "PSP", 4: "FPU_FRAME", 5: "TRAP"}
+FLAG_TRAP = 1 << 5
+
+EXCEPTIONS = {3: "HardFault", 4: "MemManage", 5: "BusFault", 6: "UsageFault", 12: "DebugMonitor"}
+
+TRAP_CODES = {1: "canary guard overwritten", 2: "stack protector canary smashed (see lr)",
+              3: "stack limit, frame below the MSP guard (see lr)",
+              255: "compiler trap"}
+
+CFSR_BITS = {
+    0: "IACCVIOL", 1: "DACCVIOL", 3: "MUNSTKERR", 4: "MSTKERR", 5: "MLSPERR", 7: "MMARVALID",
+    8: "IBUSERR", 9: "PRECISERR", 10: "IMPRECISERR", 11: "UNSTKERR", 12: "STKERR", 13: "LSPERR",
+    15: "BFARVALID", 16: "UNDEFINSTR", 17: "INVSTATE", 18: "INVPC", 19: "NOCP",
+    24: "UNALIGNED", 25: "DIVBYZERO",
+}
+
+
+def decode_words(words):
+    record = dict(zip(FIELDS, words))
+    data = struct.pack("<%dI" % (RECORD_WORDS - 1), *words[:-1])
+    record["crc_ok"] = (zlib.crc32(data) & 0xFFFFFFFF) == record["crc"]
+    return record
+
+
+def records_from_binary(blob):
+    for offset in range(0, len(blob) - RECORD_SIZE + 1, RECORD_SIZE):
+        words = struct.unpack_from("<%dI" % RECORD_WORDS, blob, offset)
+        if words[0] == 0xFFFFFFFF:
+            continue
+        yield offset // RECORD_SIZE, decode_words(words)
+
+
+def records_from_text(text):
+    index = 0
+    for line in text.splitlines():
+        pos = line.find("!CRASH:")
+        if pos < 0:
+            continue
+        digits = line[pos + len("!CRASH:"):].strip()
+        if len(digits) < RECORD_WORDS * 8:
+            continue
+        words = [int(digits[i * 8:(i + 1) * 8], 16) for i in range(RECORD_WORDS)]
+        yield index, decode_words(words)
+        index += 1
+
+
+def bit_names(value, names):
+    return " ".join(name for bit, name in sorted(names.items()) if value & (1 << bit)) or "-"
+
+
+def print_record(index, record):
+    state = "ok" if record["magic"] == MAGIC and record["crc_ok"] else "CORRUPT"
+    print("== record %d (%s) ==" % (index, state))
+    for name in FIELDS:
+        print("  %-10s 0x%08X" % (name, record[name]))
+    print("  %-10s %s" % ("cfsr bits", bit_names(record["cfsr"], CFSR_BITS)))
+    print("  %-10s %s" % ("frame", bit_names(record["flags"], FRAME_FLAGS)))
+    print("  %-10s %s" % ("fault", EXCEPTIONS.get(record["exception"], "IRQ%d" % (record["exception"] - 16))))
+    if record["flags"] & FLAG_TRAP:
+        code = (record["flags"] >> 8) & 0xFF
+        print("  %-10s %d %s" % ("trap", code, TRAP_CODES.get(code, "")))
+
+
+def main(argv):
+    if len(argv) != 2:
+        print("usage: %s <crashlog.bin | uart.log>" % argv[0], file=sys.stderr)
+        return 2
+    with open(argv[1], "rb") as f:
+        blob = f.read()
+    if b"!CRASH:" in blob:
+        records = records_from_text(blob.decode("ascii", "replace"))
+    else:
+        records = records_from_binary(blob)
+    for index, record in records:
+        print_record(index, record)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
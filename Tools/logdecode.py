@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+"""Decode LOG() frames captured from USART2.
+
+Format strings live in the non-allocated .logstr section of the ELF, a
+frame only carries the string's offset in that section and its raw
+32-bit arguments. Plain text in the capture, such as '!CRASH:' lines,
+is passed through unchanged.
+
+    Tools/logdecode.py Debug/StackGuard.elf uart.bin
+"""
+import re
+import struct
+import sys
+
+FRAME_SYNC = 0x00
+FRAME_HEADER = 4
+MAX_ARGS = 4
+
+SPEC = re.compile(r"%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|z|t)?([diouxXcps%])")
+
+
+def read_section(path, wanted):
+    with open(path, "rb") as f:
+        elf = f.read()
+    if elf[:4] != b"\x7fELF" or elf[4] != 1:
+        raise ValueError("%s is not a 32-bit ELF" % path)
+    shoff, = struct.unpack_from("<I", elf, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x2E)
+    sections = [struct.unpack_from("<IIIIIIIIII", elf, shoff + i * shentsize) for i in range(shnum)]
+    strtab = sections[shstrndx]
+    for name, _, _, _, offset, size, _, _, _, _ in sections:
+        end = elf.index(b"\0", strtab[4] + name)
+        if elf[strtab[4] + name:end].decode() == wanted:
+            return elf[offset:offset + size]
+    raise ValueError("%s has no %s section" % (path, wanted))
+
+
+def format_string(strings, log_id):
+    end = strings.find(b"\0", log_id)
+    if log_id >= len(strings) or end < 0:
+        return None
+    return strings[log_id:end].decode("ascii", "replace")
+
+
+def render(fmt, args):
+    values = iter(args)
+
+    def convert(match):
+        flags, width, precision, _, conv = match.groups()
+        if conv == "%":
+            return "%"
+        value = next(values, 0)
+        if conv in "di":
+            value = value - (1 << 32) if value & 0x80000000 else value
+        elif conv in "sp":
+            # Only the raw word went over the wire, show the address
+            return "0x%08x" % value
+        spec = "%" + flags + width + ("." + precision if precision else "") + conv
+        return spec % value
+
+    return SPEC.sub(convert, fmt)
+
+
+def decode(strings, data, out):
+    pos = 0
+    while pos < len(data):
+        if data[pos] != FRAME_SYNC:
+            end = data.find(bytes([FRAME_SYNC]), pos)
+            end = len(data) if end < 0 else end
+            out.write(data[pos:end].decode("ascii", "replace"))
+            pos = end
+            continue
+        if pos + FRAME_HEADER > len(data):
+            break
+        argc = data[pos + 1]
+        log_id, = struct.unpack_from("<H", data, pos + 2)
+        size = FRAME_HEADER + argc * 4
+        fmt = format_string(strings, log_id) if argc <= MAX_ARGS else None
+        if fmt is None or pos + size > len(data):
+            # Not a frame we know, resynchronise on the next byte
+            out.write("<?%02x>" % data[pos])
+            pos += 1
+            continue
+        args = struct.unpack_from("<%dI" % argc, data, pos + FRAME_HEADER)
+        out.write(render(fmt, args).replace("\r", ""))
+        pos += size
+
+
+def main(argv):
+    if len(argv) != 3:
+        print("usage: %s <StackGuard.elf> <uart capture>" % argv[0], file=sys.stderr)
+        return 2
+    strings = read_section(argv[1], ".logstr")
+    with open(argv[2], "rb") as f:
+        data = f.read()
+    decode(strings, data, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))